@@ -0,0 +1,603 @@
+// Drives Renderer::drawFrame for a fixed number of frames along a scripted
+// camera path and reports frame time percentiles as JSON, either to stdout or
+// to the file given with --out.
+//
+//   benchmark [--frames N] [--warmup N] [--headless] [--width W] [--height H]
+//             [--frames-in-flight N] [--objects N] [--record-threads N]
+//             [--reuse-command-buffers] [--reset-command-buffers]
+//             [--packed-vertices] [--instancing] [--indirect]
+//             [--gpu-culling] [--cpu-culling] [--async-compute]
+//             [--cull-benchmark] [--mesh-benchmark] [--out report.json]
+//             [--trace trace.json]
+//
+// --trace additionally writes the CPU profiler's Chrome trace of the
+// measured frames.
+//
+// --cull-benchmark renders nothing. It culls --objects random spheres along
+// the same camera path with FrustumCuller's SIMD and scalar loops and
+// reports the throughput of both.
+//
+// --mesh-benchmark renders nothing either. It runs MeshOptimizer on a 64x64
+// quad grid with shuffled triangles and reports the ACMR of the input, after
+// deduplication and after the whole chain.
+
+// clang-format off
+#include <vulkan/vulkan_core.h>
+#include <GLFW/glfw3.h>
+// clang-format on
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "camera.h"
+#include "cpu_profiler.h"
+#include "frustum_culler.h"
+#include "mesh_optimizer.h"
+#include "renderer.h"
+#include "window.h"
+
+struct Options
+{
+  uint32_t frames = 1000;
+  // Not measured, lets pipelines, caches and clocks settle first.
+  uint32_t warmupFrames = 100;
+  bool headless = false;
+  uint32_t width = 1280;
+  uint32_t height = 720;
+  uint32_t framesInFlight = 2;
+  uint32_t objects = 1;
+  // Zero uses one per hardware thread, see VulkanBase::Settings.
+  uint32_t recordThreads = 0;
+  bool reuseCommandBuffers = false;
+  // Resets every command buffer instead of the frame slot's pool.
+  bool resetCommandBuffers = false;
+  bool packedVertices = false;
+  bool instancing = false;
+  bool indirect = false;
+  bool gpuCulling = false;
+  bool cpuCulling = false;
+  bool asyncCompute = false;
+  bool cullBenchmark = false;
+  bool meshBenchmark = false;
+  const char* out = nullptr;
+  const char* trace = nullptr;
+};
+
+bool
+parseOptions(int argc, char** argv, Options& options)
+{
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+    if (strcmp(arg, "--headless") == 0) {
+      options.headless = true;
+      continue;
+    }
+
+    if (strcmp(arg, "--reuse-command-buffers") == 0) {
+      options.reuseCommandBuffers = true;
+      continue;
+    }
+
+    if (strcmp(arg, "--reset-command-buffers") == 0) {
+      options.resetCommandBuffers = true;
+      continue;
+    }
+
+    if (strcmp(arg, "--packed-vertices") == 0) {
+      options.packedVertices = true;
+      continue;
+    }
+
+    if (strcmp(arg, "--instancing") == 0) {
+      options.instancing = true;
+      continue;
+    }
+
+    if (strcmp(arg, "--indirect") == 0) {
+      options.indirect = true;
+      continue;
+    }
+
+    if (strcmp(arg, "--gpu-culling") == 0) {
+      options.gpuCulling = true;
+      continue;
+    }
+
+    if (strcmp(arg, "--cpu-culling") == 0) {
+      options.cpuCulling = true;
+      continue;
+    }
+
+    if (strcmp(arg, "--async-compute") == 0) {
+      options.asyncCompute = true;
+      continue;
+    }
+
+    if (strcmp(arg, "--cull-benchmark") == 0) {
+      options.cullBenchmark = true;
+      continue;
+    }
+
+    if (strcmp(arg, "--mesh-benchmark") == 0) {
+      options.meshBenchmark = true;
+      continue;
+    }
+
+    if (!value) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return false;
+    }
+
+    if (strcmp(arg, "--frames") == 0) {
+      options.frames = atoi(value);
+    } else if (strcmp(arg, "--warmup") == 0) {
+      options.warmupFrames = atoi(value);
+    } else if (strcmp(arg, "--width") == 0) {
+      options.width = atoi(value);
+    } else if (strcmp(arg, "--height") == 0) {
+      options.height = atoi(value);
+    } else if (strcmp(arg, "--frames-in-flight") == 0) {
+      options.framesInFlight = atoi(value);
+    } else if (strcmp(arg, "--objects") == 0) {
+      options.objects = atoi(value);
+    } else if (strcmp(arg, "--record-threads") == 0) {
+      options.recordThreads = atoi(value);
+    } else if (strcmp(arg, "--out") == 0) {
+      options.out = value;
+    } else if (strcmp(arg, "--trace") == 0) {
+      options.trace = value;
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return false;
+    }
+    ++i;
+  }
+
+  return options.frames > 0 && options.width > 0 && options.height > 0 &&
+         options.framesInFlight > 0 && options.objects > 0;
+}
+
+// Orbits the origin once every 360 frames, the same path for every run.
+void
+updateCameraPath(Camera& cam, uint32_t frame)
+{
+  const float radius = 5.f;
+  const float pi = 3.14159265f;
+  float yaw = 2.f * pi * (frame % 360) / 360.f;
+  float pitch = 0.25f * std::sin(yaw * 2.f);
+
+  cam.SetRotation(pitch, yaw);
+  cam.SetPosition({ -radius * std::sin(yaw) * std::cos(pitch),
+                    radius * std::sin(pitch),
+                    radius * std::cos(yaw) * std::cos(pitch) });
+}
+
+// Nearest-rank percentile of sorted values.
+double
+percentile(const std::vector<double>& sorted, double p)
+{
+  size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+  return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+// indent is the indentation of the key.
+void
+writeStats(FILE* file,
+           int indent,
+           const char* name,
+           std::vector<double> values,
+           bool last)
+{
+  const int inner = indent + 2;
+  fprintf(file, "%*s\"%s\": {\n", indent, "", name);
+  fprintf(file, "%*s\"samples\": %zu", inner, "", values.size());
+
+  if (!values.empty()) {
+    std::sort(values.begin(), values.end());
+    double sum = 0.0;
+    for (double value : values) {
+      sum += value;
+    }
+
+    fprintf(file, ",\n");
+    fprintf(file, "%*s\"min\": %.4f,\n", inner, "", values.front());
+    fprintf(file, "%*s\"mean\": %.4f,\n", inner, "", sum / values.size());
+    fprintf(file, "%*s\"p50\": %.4f,\n", inner, "", percentile(values, 50));
+    fprintf(file, "%*s\"p90\": %.4f,\n", inner, "", percentile(values, 90));
+    fprintf(file, "%*s\"p95\": %.4f,\n", inner, "", percentile(values, 95));
+    fprintf(file, "%*s\"p99\": %.4f,\n", inner, "", percentile(values, 99));
+    fprintf(file, "%*s\"max\": %.4f", inner, "", values.back());
+  }
+
+  fprintf(file, "\n%*s}%s\n", indent, "", last ? "" : ",");
+}
+
+void
+writePipelineStatistics(FILE* file, const GpuProfiler::ScopeResult& scope)
+{
+  const GpuProfiler::PipelineStatistics& stats = scope.statistics;
+  fprintf(file, "    \"%s\": {\n", scope.name);
+  fprintf(file,
+          "      \"inputAssemblyVertices\": %llu,\n"
+          "      \"inputAssemblyPrimitives\": %llu,\n"
+          "      \"vertexShaderInvocations\": %llu,\n"
+          "      \"clippingInvocations\": %llu,\n"
+          "      \"clippingPrimitives\": %llu,\n"
+          "      \"fragmentShaderInvocations\": %llu\n",
+          (unsigned long long)stats.inputAssemblyVertices,
+          (unsigned long long)stats.inputAssemblyPrimitives,
+          (unsigned long long)stats.vertexShaderInvocations,
+          (unsigned long long)stats.clippingInvocations,
+          (unsigned long long)stats.clippingPrimitives,
+          (unsigned long long)stats.fragmentShaderInvocations);
+  fprintf(file, "    }");
+}
+
+// Culls the same spheres with Cull() and CullScalar() for every frame of the
+// camera path and reports objects culled per millisecond.
+int
+runCullBenchmark(const Options& options)
+{
+  // Spread over a cube, the camera path sees roughly a quarter of it.
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> position(-50.f, 50.f);
+  std::uniform_real_distribution<float> radius(0.1f, 2.f);
+
+  std::vector<glm::vec4> spheres(options.objects);
+  for (auto& sphere : spheres) {
+    sphere = glm::vec4(
+      position(random), position(random), position(random), radius(random));
+  }
+
+  FrustumCuller culler;
+  culler.SetSpheres(spheres.data(), options.objects);
+  std::vector<uint32_t> visible(options.objects);
+  std::vector<uint32_t> visibleScalar(options.objects);
+
+  Camera cam(70.f, float(options.width) / options.height, 0.1f, 1000.f);
+
+  std::vector<double> simdMs;
+  std::vector<double> scalarMs;
+  uint64_t visibleTotal = 0;
+
+  using Clock = std::chrono::steady_clock;
+  using Ms = std::chrono::duration<double, std::milli>;
+
+  uint32_t frameCount = options.warmupFrames + options.frames;
+  for (uint32_t i = 0; i < frameCount; ++i) {
+    updateCameraPath(cam, i);
+    glm::mat4 projView = cam.GetProjView();
+
+    auto start = Clock::now();
+    uint32_t count = culler.Cull(projView, visible.data());
+    auto simdEnd = Clock::now();
+    uint32_t countScalar = culler.CullScalar(projView, visibleScalar.data());
+    auto scalarEnd = Clock::now();
+
+    if (count != countScalar ||
+        !std::equal(
+          visible.begin(), visible.begin() + count, visibleScalar.begin())) {
+      fprintf(stderr, "SIMD and scalar culling differ in frame %u\n", i);
+      return 1;
+    }
+
+    if (i < options.warmupFrames)
+      continue;
+
+    simdMs.push_back(Ms(simdEnd - start).count());
+    scalarMs.push_back(Ms(scalarEnd - simdEnd).count());
+    visibleTotal += count;
+  }
+
+  double simdSum = 0.0;
+  double scalarSum = 0.0;
+  for (uint32_t i = 0; i < options.frames; ++i) {
+    simdSum += simdMs[i];
+    scalarSum += scalarMs[i];
+  }
+  double objects = double(options.objects) * options.frames;
+
+  FILE* file = options.out ? fopen(options.out, "w") : stdout;
+  if (!file) {
+    fprintf(stderr, "cannot open %s\n", options.out);
+    return 1;
+  }
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"objects\": %u,\n", options.objects);
+  fprintf(file, "  \"frames\": %u,\n", options.frames);
+  fprintf(file, "  \"simdWidth\": %u,\n", FrustumCuller::GetWidth());
+  fprintf(file,
+          "  \"visiblePerFrame\": %.1f,\n",
+          double(visibleTotal) / options.frames);
+  fprintf(file, "  \"simdObjectsPerMs\": %.1f,\n", objects / simdSum);
+  fprintf(file, "  \"scalarObjectsPerMs\": %.1f,\n", objects / scalarSum);
+  writeStats(file, 2, "simdMs", simdMs, false);
+  writeStats(file, 2, "scalarMs", scalarMs, true);
+  fprintf(file, "}\n");
+
+  if (file != stdout) {
+    fclose(file);
+  }
+
+  return 0;
+}
+
+// Optimizes a grid of kGridSize x kGridSize quads given as a non-indexed
+// triangle list in random triangle order, the worst case for the cache.
+int
+runMeshBenchmark(const Options& options)
+{
+  const uint32_t kGridSize = 64;
+
+  std::vector<glm::vec3> triangles;
+  for (uint32_t y = 0; y < kGridSize; ++y) {
+    for (uint32_t x = 0; x < kGridSize; ++x) {
+      glm::vec3 v00(x, y, 0.f);
+      glm::vec3 v10(x + 1, y, 0.f);
+      glm::vec3 v01(x, y + 1, 0.f);
+      glm::vec3 v11(x + 1, y + 1, 0.f);
+      triangles.insert(triangles.end(), { v00, v10, v11, v00, v11, v01 });
+    }
+  }
+
+  uint32_t triangleCount = static_cast<uint32_t>(triangles.size() / 3);
+  std::vector<uint32_t> order(triangleCount);
+  for (uint32_t i = 0; i < triangleCount; ++i) {
+    order[i] = i;
+  }
+  std::mt19937 random(1);
+  std::shuffle(order.begin(), order.end(), random);
+
+  std::vector<glm::vec3> vertices;
+  vertices.reserve(triangles.size());
+  for (uint32_t triangle : order) {
+    vertices.insert(vertices.end(),
+                    triangles.begin() + triangle * 3,
+                    triangles.begin() + triangle * 3 + 3);
+  }
+
+  using Clock = std::chrono::steady_clock;
+  using Ms = std::chrono::duration<double, std::milli>;
+
+  std::vector<uint32_t> indices;
+  auto start = Clock::now();
+  MeshOptimizer::Stats stats = MeshOptimizer::Optimize(vertices, indices);
+  double optimizeMs = Ms(Clock::now() - start).count();
+
+  FILE* file = options.out ? fopen(options.out, "w") : stdout;
+  if (!file) {
+    fprintf(stderr, "cannot open %s\n", options.out);
+    return 1;
+  }
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"gridSize\": %u,\n", kGridSize);
+  fprintf(file, "  \"triangles\": %u,\n", triangleCount);
+  fprintf(file, "  \"verticesBefore\": %u,\n", stats.vertexCountBefore);
+  fprintf(file, "  \"vertices\": %u,\n", stats.vertexCount);
+  fprintf(file,
+          "  \"cacheSize\": %u,\n",
+          MeshOptimizer::kSimulatedCacheSize);
+  fprintf(file, "  \"acmrBefore\": %.4f,\n", stats.acmrBefore);
+  fprintf(file, "  \"acmrDeduplicated\": %.4f,\n", stats.acmrDeduplicated);
+  fprintf(file, "  \"acmr\": %.4f,\n", stats.acmr);
+  fprintf(file, "  \"optimizeMs\": %.3f\n", optimizeMs);
+  fprintf(file, "}\n");
+
+  if (file != stdout) {
+    fclose(file);
+  }
+
+  return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    fprintf(stderr,
+            "usage: benchmark [--frames N] [--warmup N] [--headless] "
+            "[--width W] [--height H] [--frames-in-flight N] "
+            "[--objects N] [--record-threads N] [--reuse-command-buffers] "
+            "[--reset-command-buffers] [--packed-vertices] [--instancing] "
+            "[--indirect] [--gpu-culling] [--cpu-culling] "
+            "[--async-compute] [--cull-benchmark] [--mesh-benchmark] "
+            "[--out report.json] [--trace trace.json]\n");
+    return 1;
+  }
+
+  if (options.cullBenchmark) {
+    return runCullBenchmark(options);
+  }
+
+  if (options.meshBenchmark) {
+    return runMeshBenchmark(options);
+  }
+
+  VulkanBase::Settings settings;
+  settings.framesInFlight = options.framesInFlight;
+  // Validation would dominate the CPU timings.
+  settings.validation = false;
+  settings.headlessExtent = { options.width, options.height };
+  settings.objectCount = options.objects;
+  settings.recordThreads = options.recordThreads;
+  settings.reuseCommandBuffers = options.reuseCommandBuffers;
+  settings.resetCommandPools = !options.resetCommandBuffers;
+  settings.packedVertices = options.packedVertices;
+  settings.instancing = options.instancing;
+  settings.indirectDraws = options.indirect;
+  settings.gpuCulling = options.gpuCulling;
+  settings.cpuCulling = options.cpuCulling;
+  settings.asyncCompute = options.asyncCompute;
+
+  std::unique_ptr<Window> window;
+  if (!options.headless) {
+    window.reset(new Window(options.width, options.height, "Benchmark"));
+  }
+
+  Renderer renderer(window.get(), settings);
+
+  VkExtent2D extent = renderer.swapchain->imageExtent;
+  Camera cam(70.f, float(extent.width) / extent.height, 0.1f, 1000.f);
+
+  std::vector<double> cpuFrameMs;
+  std::vector<double> gpuFrameMs;
+  std::vector<double> recordMs;
+  std::vector<double> submitMs;
+  std::vector<double> presentMs;
+  // Per profiler scope, keyed by the scope's path, e.g. "frame/renderPass".
+  std::map<std::string, std::vector<double>> gpuScopeMs;
+
+  using Clock = std::chrono::steady_clock;
+  using Ms = std::chrono::duration<double, std::milli>;
+
+  uint32_t frameCount = options.warmupFrames + options.frames;
+  CpuProfiler::SetThreadName("Main");
+
+  for (uint32_t i = 0; i < frameCount; ++i) {
+    if (options.trace && i == options.warmupFrames) {
+      CpuProfiler::Enable(true);
+    }
+
+    PROFILE_SCOPE("Frame");
+    auto frameStart = Clock::now();
+
+    if (window) {
+      window->Update();
+      renderer.Update();
+    }
+
+    updateCameraPath(cam, i);
+    renderer.drawFrame(cam.GetProjView());
+
+    if (i < options.warmupFrames)
+      continue;
+
+    cpuFrameMs.push_back(Ms(Clock::now() - frameStart).count());
+    recordMs.push_back(renderer.timings.recordMs);
+    submitMs.push_back(renderer.timings.submitMs);
+    presentMs.push_back(renderer.timings.presentMs);
+    // GPU results trail by framesInFlight frames, the first ones measured
+    // belong to the warmup.
+    if (renderer.timings.gpuMs >= 0.0) {
+      gpuFrameMs.push_back(renderer.timings.gpuMs);
+
+      std::vector<std::string> path;
+      for (const auto& scope : renderer.gpuProfiler->GetResults()) {
+        path.resize(scope.depth);
+        path.push_back(path.empty() ? scope.name
+                                    : path.back() + "/" + scope.name);
+        gpuScopeMs[path.back()].push_back(scope.gpuMs);
+      }
+    }
+  }
+
+  CpuProfiler::Enable(false);
+  if (options.trace && !CpuProfiler::WriteTrace(options.trace)) {
+    fprintf(stderr, "cannot write %s\n", options.trace);
+  }
+
+  FILE* file = options.out ? fopen(options.out, "w") : stdout;
+  if (!file) {
+    fprintf(stderr, "cannot open %s\n", options.out);
+    return 1;
+  }
+
+  fprintf(file, "{\n");
+  fprintf(file,
+          "  \"device\": \"%s\",\n",
+          renderer.physicalDeviceProps.props.deviceName);
+  fprintf(file, "  \"headless\": %s,\n", options.headless ? "true" : "false");
+  fprintf(file, "  \"width\": %u,\n", extent.width);
+  fprintf(file, "  \"height\": %u,\n", extent.height);
+  fprintf(file, "  \"framesInFlight\": %u,\n", options.framesInFlight);
+  fprintf(file, "  \"warmupFrames\": %u,\n", options.warmupFrames);
+  fprintf(file, "  \"frames\": %u,\n", options.frames);
+  fprintf(file, "  \"objects\": %u,\n", options.objects);
+  fprintf(file,
+          "  \"instancing\": %s,\n",
+          options.instancing ? "true" : "false");
+  fprintf(file,
+          "  \"indirect\": %s,\n",
+          options.indirect ? "true" : "false");
+  fprintf(file,
+          "  \"gpuCulling\": %s,\n",
+          options.gpuCulling ? "true" : "false");
+  fprintf(file,
+          "  \"cpuCulling\": %s,\n",
+          options.cpuCulling ? "true" : "false");
+  // Whether a separate queue was found, not just requested.
+  fprintf(file,
+          "  \"asyncCompute\": %s,\n",
+          renderer.HasAsyncCompute() ? "true" : "false");
+  fprintf(file,
+          "  \"recordThreads\": %u,\n",
+          renderer.recorder->threadCount);
+  fprintf(file,
+          "  \"reuseCommandBuffers\": %s,\n",
+          options.reuseCommandBuffers ? "true" : "false");
+  fprintf(file,
+          "  \"commandBufferReset\": \"%s\",\n",
+          options.resetCommandBuffers ? "buffer" : "pool");
+  const MeshOptimizer::Stats& mesh = renderer.meshStats;
+  fprintf(file, "  \"mesh\": {\n");
+  fprintf(file, "    \"verticesBefore\": %u,\n", mesh.vertexCountBefore);
+  fprintf(file, "    \"vertices\": %u,\n", mesh.vertexCount);
+  fprintf(file, "    \"indices\": %u,\n", mesh.indexCount);
+  fprintf(file,
+          "    \"vertexBytes\": %zu,\n",
+          options.packedVertices ? sizeof(PackedVertex) : sizeof(Vertex));
+  fprintf(file,
+          "    \"indexBits\": %u,\n",
+          renderer.indexType == VK_INDEX_TYPE_UINT16 ? 16 : 32);
+  fprintf(file, "    \"acmrBefore\": %.4f,\n", mesh.acmrBefore);
+  fprintf(file,
+          "    \"acmrDeduplicated\": %.4f,\n",
+          mesh.acmrDeduplicated);
+  fprintf(file, "    \"acmr\": %.4f\n", mesh.acmr);
+  fprintf(file, "  },\n");
+  writeStats(file, 2, "cpuFrameMs", cpuFrameMs, false);
+  writeStats(file, 2, "gpuFrameMs", gpuFrameMs, false);
+  writeStats(file, 2, "recordMs", recordMs, false);
+  writeStats(file, 2, "submitMs", submitMs, false);
+  writeStats(file, 2, "presentMs", presentMs, false);
+
+  fprintf(file, "  \"gpuScopesMs\": {\n");
+  for (auto it = gpuScopeMs.begin(); it != gpuScopeMs.end(); ++it) {
+    bool last = std::next(it) == gpuScopeMs.end();
+    writeStats(file, 4, it->first.c_str(), it->second, last);
+  }
+  fprintf(file, "  },\n");
+
+  // Counters of the last frame only, the scene does not change.
+  fprintf(file, "  \"pipelineStatistics\": {");
+  const char* separator = "\n";
+  for (const auto& scope : renderer.gpuProfiler->GetResults()) {
+    if (!scope.hasStatistics)
+      continue;
+    fprintf(file, "%s", separator);
+    writePipelineStatistics(file, scope);
+    separator = ",\n";
+  }
+  fprintf(file, "\n  }\n");
+  fprintf(file, "}\n");
+
+  if (file != stdout) {
+    fclose(file);
+  }
+
+  return 0;
+}
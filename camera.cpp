@@ -1,5 +1,5 @@
 #include "camera.h"
-#include <glm\gtx\transform.hpp>
+#include <glm/gtx/transform.hpp>
 
 void
 Camera::SetPosition(glm::vec3 pos)
@@ -9,6 +9,17 @@ Camera::SetPosition(glm::vec3 pos)
   UpdateProjView();
 }
 
+void
+Camera::SetRotation(float pitch, float yaw)
+{
+  this->pitch = pitch;
+  this->yaw = yaw;
+  rotation = glm::rotate(pitch, glm::vec3(1.f, 0.f, 0.f)) *
+             glm::rotate(yaw, glm::vec3(0.f, 1.f, 0.f));
+  UpdateView();
+  UpdateProjView();
+}
+
 void
 Camera::Update(Input* input, Clock* clock)
 {
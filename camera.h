@@ -31,6 +31,8 @@ struct Camera
   };
 
   void SetPosition(glm::vec3 pos);
+  // Radians, yaw turns about the world y axis.
+  void SetRotation(float pitch, float yaw);
   void Update(Input* input, Clock* clock);
 
   glm::mat4 GetProjView() { return projView; }
@@ -0,0 +1,115 @@
+#include "command_recorder.h"
+
+#include <algorithm>
+#include <future>
+
+#include "cpu_profiler.h"
+#include "vk_init.h"
+#include "vk_utils.h"
+
+CommandRecorder::CommandRecorder(VkDevice device,
+                                 uint32_t queueFamilyIdx,
+                                 uint32_t frameCount,
+                                 ThreadPool* threadPool,
+                                 uint32_t threadCount)
+  : device(device)
+  , frameCount(frameCount)
+  , threadCount(threadCount)
+  , threadPool(threadPool)
+{
+  uint32_t maxThreads = threadPool ? threadPool->GetThreadCount() + 1 : 1;
+  if (this->threadCount == 0 || this->threadCount > maxThreads) {
+    this->threadCount = maxThreads;
+  }
+
+  // Buffers are rerecorded every frame and freed with a pool reset.
+  auto poolInfo = vkiCommandPoolCreateInfo(queueFamilyIdx);
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+  pools.resize(frameCount * this->threadCount);
+  for (auto& pool : pools) {
+    ASSERT_VK_SUCCESS(
+      vkCreateCommandPool(device, &poolInfo, nullptr, &pool.handle));
+  }
+}
+
+CommandRecorder::~CommandRecorder()
+{
+  for (auto& pool : pools) {
+    vkDestroyCommandPool(device, pool.handle, nullptr);
+  }
+}
+
+void
+CommandRecorder::BeginFrame(uint32_t frameIdx)
+{
+  this->frameIdx = frameIdx;
+
+  for (uint32_t i = 0; i < threadCount; ++i) {
+    Pool& pool = pools[frameIdx * threadCount + i];
+    if (pool.used == 0)
+      continue;
+
+    ASSERT_VK_SUCCESS(vkResetCommandPool(device, pool.handle, 0));
+    pool.used = 0;
+  }
+}
+
+std::vector<VkCommandBuffer>
+CommandRecorder::Record(const VkCommandBufferInheritanceInfo& inheritance,
+                        uint32_t itemCount,
+                        const RecordFunc& record,
+                        uint32_t minItemsPerTask)
+{
+  uint32_t taskCount = itemCount / std::max(minItemsPerTask, 1u);
+  taskCount = std::min(std::max(taskCount, 1u), threadCount);
+
+  std::vector<VkCommandBuffer> cmdBuffers(taskCount);
+
+  auto recordRange = [&](uint32_t taskIdx) {
+    PROFILE_SCOPE("CommandRecorder::Record task");
+    uint32_t first = uint64_t(itemCount) * taskIdx / taskCount;
+    uint32_t end = uint64_t(itemCount) * (taskIdx + 1) / taskCount;
+
+    VkCommandBuffer cmd = GetCommandBuffer(taskIdx);
+    VkCommandBufferBeginInfo beginInfo =
+      vkiCommandBufferBeginInfo(&inheritance);
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                      VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    ASSERT_VK_SUCCESS(vkBeginCommandBuffer(cmd, &beginInfo));
+    record(cmd, first, end - first);
+    ASSERT_VK_SUCCESS(vkEndCommandBuffer(cmd));
+
+    cmdBuffers[taskIdx] = cmd;
+  };
+
+  std::vector<std::future<void>> tasks;
+  for (uint32_t taskIdx = 1; taskIdx < taskCount; ++taskIdx) {
+    tasks.push_back(
+      threadPool->Submit([&recordRange, taskIdx]() { recordRange(taskIdx); }));
+  }
+
+  recordRange(0);
+
+  for (auto& task : tasks) {
+    task.get();
+  }
+
+  return cmdBuffers;
+}
+
+VkCommandBuffer
+CommandRecorder::GetCommandBuffer(uint32_t taskIdx)
+{
+  Pool& pool = pools[frameIdx * threadCount + taskIdx];
+
+  if (pool.used == pool.cmdBuffers.size()) {
+    VkCommandBuffer cmd = VK_NULL_HANDLE;
+    auto allocateInfo = vkiCommandBufferAllocateInfo(
+      pool.handle, VK_COMMAND_BUFFER_LEVEL_SECONDARY, 1);
+    ASSERT_VK_SUCCESS(vkAllocateCommandBuffers(device, &allocateInfo, &cmd));
+    pool.cmdBuffers.push_back(cmd);
+  }
+
+  return pool.cmdBuffers[pool.used++];
+}
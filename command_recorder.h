@@ -0,0 +1,73 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "thread_pool.h"
+
+// Records secondary command buffers on several threads. Work is split into
+// contiguous ranges, one per task; the calling thread records the first range
+// itself while workers of the shared thread pool take the others. Pipeline
+// compiles queued on the same pool can delay a range but never deadlock it:
+// they do not wait on recording, and the caller only waits on its own tasks.
+//
+// Every frame in flight has one command pool per task index. A task only
+// ever touches its own pool, so recording needs no locks, and all pools of a
+// frame are reset at once when the frame's slot is reused.
+struct CommandRecorder
+{
+  // Records items [first, first + count) into cmd.
+  typedef std::function<void(VkCommandBuffer cmd,
+                             uint32_t first,
+                             uint32_t count)>
+    RecordFunc;
+
+  VkDevice device = VK_NULL_HANDLE;
+  uint32_t frameCount = 0;
+  uint32_t threadCount = 0;
+
+  // Ranges other than the first run on threadPool, which may be nullptr to
+  // record single threaded. threadCount counts the calling thread and is
+  // capped to the pool's workers plus one; zero uses all of them.
+  CommandRecorder(VkDevice device,
+                  uint32_t queueFamilyIdx,
+                  uint32_t frameCount,
+                  ThreadPool* threadPool,
+                  uint32_t threadCount = 0);
+
+  CommandRecorder(const CommandRecorder&) = delete;
+  CommandRecorder& operator=(const CommandRecorder&) = delete;
+
+  ~CommandRecorder();
+
+  // Resets all command buffers of the frame, call once its fence signalled.
+  void BeginFrame(uint32_t frameIdx);
+
+  // Splits itemCount items into at most threadCount ranges of at least
+  // minItemsPerTask items and records each into a secondary command buffer
+  // continuing the render pass described by inheritance. Blocks until all
+  // are recorded and returns them in range order, ready for
+  // vkCmdExecuteCommands.
+  std::vector<VkCommandBuffer> Record(
+    const VkCommandBufferInheritanceInfo& inheritance,
+    uint32_t itemCount,
+    const RecordFunc& record,
+    uint32_t minItemsPerTask = 256);
+
+private:
+  struct Pool
+  {
+    VkCommandPool handle = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> cmdBuffers = {};
+    uint32_t used = 0;
+  };
+
+  // frameCount * threadCount pools, frame major.
+  std::vector<Pool> pools = {};
+  uint32_t frameIdx = 0;
+  // Not owned, nullptr when recording single threaded.
+  ThreadPool* threadPool = nullptr;
+
+  VkCommandBuffer GetCommandBuffer(uint32_t taskIdx);
+};
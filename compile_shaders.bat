@@ -1,3 +1,3 @@
 echo off
 mkdir build
-for %%x in (simple.vert simple.frag) do tools\glslangValidator.exe -V res\shaders\%%x -o build\%%x.spv"
\ No newline at end of file
+for %%x in (simple.vert packed.vert simple.frag cull.comp) do tools\glslangValidator.exe -V res\shaders\%%x -o build\%%x.spv"
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "compute_pipeline.h"
+
+#include <algorithm>
+
+#include "cpu_profiler.h"
+#include "pipeline_key.h"
+
+ComputePipeline::~ComputePipeline()
+{
+  vkDestroyPipeline(device, pipeline, nullptr);
+}
+
+void
+ComputePipeline::CmdBind(VkCommandBuffer cmd) const
+{
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+}
+
+void
+ComputePipeline::CmdBindDescriptorSets(
+  VkCommandBuffer cmd,
+  uint32_t firstSet,
+  const std::vector<VkDescriptorSet>& descriptorSets,
+  const std::vector<uint32_t>& dynamicOffsets) const
+{
+  vkCmdBindDescriptorSets(cmd,
+                          VK_PIPELINE_BIND_POINT_COMPUTE,
+                          pipelineLayout,
+                          firstSet,
+                          static_cast<uint32_t>(descriptorSets.size()),
+                          descriptorSets.data(),
+                          static_cast<uint32_t>(dynamicOffsets.size()),
+                          dynamicOffsets.data());
+}
+
+void
+ComputePipeline::CmdPushConstants(VkCommandBuffer cmd,
+                                  uint32_t offset,
+                                  uint32_t size,
+                                  const void* values) const
+{
+  vkCmdPushConstants(
+    cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, offset, size, values);
+}
+
+void
+ComputePipeline::CmdDispatch(VkCommandBuffer cmd,
+                             uint32_t x,
+                             uint32_t y,
+                             uint32_t z) const
+{
+  vkCmdDispatch(cmd,
+                (x + localSize[0] - 1) / localSize[0],
+                (y + localSize[1] - 1) / localSize[1],
+                (z + localSize[2] - 1) / localSize[2]);
+}
+
+void
+ComputePipeline::CmdDispatchIndirect(VkCommandBuffer cmd,
+                                     VkBuffer buffer,
+                                     VkDeviceSize offset) const
+{
+  vkCmdDispatchIndirect(cmd, buffer, offset);
+}
+
+ComputePipeline::Builder
+ComputePipeline::GetBuilder()
+{
+  return Builder();
+}
+
+std::string
+ComputePipeline::Builder::GetKey(VkPipelineLayout pipelineLayout) const
+{
+  KeyWriter key;
+  key.Write(Device);
+  key.Write(pipelineLayout);
+  key.Write(Shader);
+  key.Write(EntryPoint);
+  key.Write(SpecializationMapEntries);
+  key.Write(SpecializationData);
+  key.Write(LocalSize);
+  return key.bytes;
+}
+
+std::shared_ptr<ComputePipeline>
+ComputePipeline::Builder::Build()
+{
+  PROFILE_SCOPE("ComputePipeline::Builder::Build");
+
+  std::shared_ptr<PipelineLayout> layout =
+    buildPipelineLayout(Device,
+                        ObjectCache,
+                        SharedLayouts,
+                        DescriptorSetLayouts,
+                        PushConstantRanges);
+
+  std::string key;
+  if (ObjectCache) {
+    key = GetKey(layout->handle);
+    auto cached = ObjectCache->FindComputePipeline(key);
+    if (cached)
+      return cached;
+  }
+
+  std::shared_ptr<ComputePipeline> computePipeline(new ComputePipeline);
+  computePipeline->device = Device;
+  computePipeline->layout = layout;
+  computePipeline->pipelineLayout = layout->handle;
+  for (const auto& setLayout : layout->ownedSetLayouts) {
+    computePipeline->descriptorSetLayouts.push_back(setLayout->handle);
+  }
+  for (int i = 0; i < 3; ++i) {
+    computePipeline->localSize[i] = std::max(LocalSize[i], 1u);
+  }
+
+  // Append the local size after the caller's constants, 4-byte aligned.
+  std::vector<VkSpecializationMapEntry> mapEntries = SpecializationMapEntries;
+  std::vector<uint8_t> data = SpecializationData;
+  data.resize((data.size() + 3) & ~size_t(3));
+  for (uint32_t i = 0; i < 3; ++i) {
+    mapEntries.push_back({ i,
+                           static_cast<uint32_t>(data.size()),
+                           sizeof(uint32_t) });
+    const auto* bytes =
+      reinterpret_cast<const uint8_t*>(&computePipeline->localSize[i]);
+    data.insert(data.end(), bytes, bytes + sizeof(uint32_t));
+  }
+
+  auto specialization =
+    vkiSpecializationInfo(static_cast<uint32_t>(mapEntries.size()),
+                          mapEntries.data(),
+                          data.size(),
+                          data.data());
+
+  computePipeline->pipeline =
+    vkuCreateComputePipeline(Device,
+                             Shader,
+                             computePipeline->pipelineLayout,
+                             PipelineCache,
+                             EntryPoint.c_str(),
+                             &specialization);
+
+  if (ObjectCache)
+    return ObjectCache->InsertComputePipeline(key, computePipeline);
+
+  return computePipeline;
+}
+
+ComputePipeline::Pending
+ComputePipeline::Builder::BuildAsync(ThreadPool& pool) const
+{
+  Builder builder = *this;
+
+  Pending pending;
+  pending.future = pool.Submit([builder]() mutable { return builder.Build(); })
+                     .share();
+  return pending;
+}
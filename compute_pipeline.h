@@ -0,0 +1,119 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+#include "graphics_pipeline.h"
+#include "thread_pool.h"
+
+// Compute counterpart of GraphicsPipeline, built the same way and cached in
+// the same PipelineObjectCache. The Cmd* helpers record against the
+// compute bind point with the pipeline's own layout.
+struct ComputePipeline
+{
+  VkDevice device = VK_NULL_HANDLE;
+  // Layouts created from Builder::DescriptorSetLayouts, in order.
+  std::vector<VkDescriptorSetLayout> descriptorSetLayouts = {};
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  // Workgroup size of the shader, see Builder::LocalSize.
+  uint32_t localSize[3] = { 1, 1, 1 };
+
+  std::shared_ptr<PipelineLayout> layout = nullptr;
+
+  struct Builder;
+  friend struct Builder;
+  static Builder GetBuilder();
+
+  typedef PendingPipeline<ComputePipeline> Pending;
+
+  ComputePipeline& operator=(const ComputePipeline&) = delete;
+  ComputePipeline(const ComputePipeline&) = delete;
+
+  ~ComputePipeline();
+
+  void CmdBind(VkCommandBuffer cmd) const;
+  void CmdBindDescriptorSets(
+    VkCommandBuffer cmd,
+    uint32_t firstSet,
+    const std::vector<VkDescriptorSet>& descriptorSets,
+    const std::vector<uint32_t>& dynamicOffsets = {}) const;
+  void CmdPushConstants(VkCommandBuffer cmd,
+                        uint32_t offset,
+                        uint32_t size,
+                        const void* values) const;
+
+  // Dispatches enough workgroups to cover x * y * z invocations. The shader
+  // skips the invocations past the end of the last group.
+  void CmdDispatch(VkCommandBuffer cmd,
+                   uint32_t x,
+                   uint32_t y = 1,
+                   uint32_t z = 1) const;
+  // Reads a VkDispatchIndirectCommand, in workgroups, from buffer.
+  void CmdDispatchIndirect(VkCommandBuffer cmd,
+                           VkBuffer buffer,
+                           VkDeviceSize offset) const;
+
+private:
+  ComputePipeline() = default;
+};
+
+struct ComputePipeline::Builder
+{
+  VkDevice Device = VK_NULL_HANDLE;
+  VkShaderModule Shader = VK_NULL_HANDLE;
+  std::string EntryPoint = "main";
+  std::vector<VkDescriptorSetLayout> SharedLayouts{};
+  std::vector<std::vector<VkDescriptorSetLayoutBinding>> DescriptorSetLayouts{};
+  std::vector<VkPushConstantRange> PushConstantRanges = {};
+  std::vector<VkSpecializationMapEntry> SpecializationMapEntries = {};
+  std::vector<uint8_t> SpecializationData = {};
+  VkPipelineCache PipelineCache = VK_NULL_HANDLE;
+  PipelineObjectCache* ObjectCache = nullptr;
+
+  // clang-format off
+#define SETTER(type, ident)            \
+	Builder& Set##ident(type ident) {  \
+		this->ident = ident;           \
+		return *this;                  \
+	}
+
+		SETTER(VkDevice, Device)
+		SETTER(VkShaderModule, Shader)
+		SETTER(std::string, EntryPoint)
+		SETTER(std::vector<VkDescriptorSetLayout>, SharedLayouts)
+		SETTER(std::vector<std::vector<VkDescriptorSetLayoutBinding>>, DescriptorSetLayouts)
+		SETTER(std::vector<VkPushConstantRange>, PushConstantRanges)
+		SETTER(std::vector<VkSpecializationMapEntry>, SpecializationMapEntries)
+		SETTER(std::vector<uint8_t>, SpecializationData)
+		SETTER(VkPipelineCache, PipelineCache)
+		SETTER(PipelineObjectCache*, ObjectCache)
+
+#undef SETTER
+  // clang-format on
+
+  // Workgroup size, the single source of truth for both the shader and
+  // CmdDispatch. It is passed as specialization constants 0, 1 and 2, which
+  // are reserved for it; declare the shader's size with
+  // layout(local_size_x_id = 0, local_size_y_id = 1, local_size_z_id = 2) in;
+  // leaving out the ids of dimensions that stay 1.
+  uint32_t LocalSize[3] = { 1, 1, 1 };
+
+  Builder& SetLocalSize(uint32_t x, uint32_t y = 1, uint32_t z = 1)
+  {
+    LocalSize[0] = x;
+    LocalSize[1] = y;
+    LocalSize[2] = z;
+    return *this;
+  }
+
+  std::shared_ptr<ComputePipeline> Build();
+  // Compiles a copy of this builder's state on the pool, see
+  // GraphicsPipeline::Builder::BuildAsync.
+  Pending BuildAsync(ThreadPool& pool) const;
+
+private:
+  std::string GetKey(VkPipelineLayout pipelineLayout) const;
+};
@@ -0,0 +1,153 @@
+#include "cpu_profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct EventRing
+{
+  uint32_t threadIdx = 0;
+  std::string threadName = {};
+  std::vector<CpuProfiler::Event> events = {};
+  // Events ever recorded, only the owning thread writes it.
+  std::atomic<uint64_t> head{ 0 };
+};
+
+// Rings are never freed, threads may exit before the trace is written.
+static std::mutex ringsMutex;
+static std::vector<std::unique_ptr<EventRing>> rings;
+static thread_local EventRing* threadRing = nullptr;
+// Applied once the thread records, naming alone allocates nothing.
+static thread_local const char* threadName = nullptr;
+
+static EventRing*
+getThreadRing()
+{
+  if (!threadRing) {
+    std::unique_ptr<EventRing> ring(new EventRing);
+    ring->events.resize(CpuProfiler::kRingSize);
+    ring->threadName = threadName ? threadName : "";
+
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    ring->threadIdx = static_cast<uint32_t>(rings.size());
+    threadRing = ring.get();
+    rings.push_back(std::move(ring));
+  }
+  return threadRing;
+}
+
+// Names are string literals, but escape anyway to never break the JSON.
+static void
+writeString(FILE* file, const char* str)
+{
+  fputc('"', file);
+  for (; *str; ++str) {
+    if (*str == '"' || *str == '\\') {
+      fputc('\\', file);
+    }
+    fputc(*str, file);
+  }
+  fputc('"', file);
+}
+
+const uint32_t CpuProfiler::kRingSize;
+std::atomic<bool> CpuProfiler::enabled{ false };
+
+void
+CpuProfiler::Enable(bool enable)
+{
+  enabled.store(enable, std::memory_order_relaxed);
+}
+
+uint64_t
+CpuProfiler::Now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch())
+    .count();
+}
+
+void
+CpuProfiler::Record(const char* name, uint64_t beginNs, uint64_t endNs)
+{
+  EventRing* ring = getThreadRing();
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+
+  Event& event = ring->events[head % kRingSize];
+  event.name = name;
+  event.beginNs = beginNs;
+  event.endNs = endNs;
+
+  // Publishes the event to WriteTrace.
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+void
+CpuProfiler::SetThreadName(const char* name)
+{
+  threadName = name;
+
+  if (threadRing) {
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    threadRing->threadName = name;
+  }
+}
+
+bool
+CpuProfiler::WriteTrace(const char* path)
+{
+  FILE* file = fopen(path, "w");
+  if (!file)
+    return false;
+
+  std::lock_guard<std::mutex> lock(ringsMutex);
+
+  // Timestamps relative to the oldest event keep the numbers readable.
+  uint64_t originNs = UINT64_MAX;
+  for (const auto& ring : rings) {
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t first = head > kRingSize ? head - kRingSize : 0;
+    for (uint64_t i = first; i < head; ++i) {
+      originNs = std::min(originNs, ring->events[i % kRingSize].beginNs);
+    }
+  }
+
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  const char* separator = "\n";
+
+  for (const auto& ring : rings) {
+    if (!ring->threadName.empty()) {
+      fprintf(file,
+              "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,"
+              "\"tid\":%u,\"args\":{\"name\":",
+              separator,
+              ring->threadIdx);
+      writeString(file, ring->threadName.c_str());
+      fprintf(file, "}}");
+      separator = ",\n";
+    }
+
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t first = head > kRingSize ? head - kRingSize : 0;
+
+    for (uint64_t i = first; i < head; ++i) {
+      const Event& event = ring->events[i % kRingSize];
+      fprintf(file, "%s{\"ph\":\"X\",\"name\":", separator);
+      writeString(file, event.name);
+      fprintf(file,
+              ",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+              ring->threadIdx,
+              (event.beginNs - originNs) * 1e-3,
+              (event.endNs - event.beginNs) * 1e-3);
+      separator = ",\n";
+    }
+  }
+
+  fprintf(file, "\n]}\n");
+  return fclose(file) == 0;
+}
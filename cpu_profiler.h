@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Scoped CPU timings, written as Chrome trace JSON (chrome://tracing,
+// Perfetto). Each thread records into its own fixed-size ring, so recording
+// takes no locks; only a thread's first event registers its ring. Once a
+// ring is full the oldest events are overwritten.
+//
+//   void Foo()
+//   {
+//     PROFILE_SCOPE("Foo");
+//     ...
+//   }
+//
+// Recording is off until Enable(true), a disabled scope costs one relaxed
+// atomic load.
+struct CpuProfiler
+{
+  struct Event
+  {
+    // Must outlive the profiler, pass string literals.
+    const char* name;
+    uint64_t beginNs;
+    uint64_t endNs;
+  };
+
+  // Events kept per thread.
+  static const uint32_t kRingSize = 64 * 1024;
+
+  static void Enable(bool enable);
+  static bool IsEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+  static uint64_t Now();
+  static void Record(const char* name, uint64_t beginNs, uint64_t endNs);
+
+  // Names the calling thread in the trace. name must stay valid until the
+  // thread records its first event.
+  static void SetThreadName(const char* name);
+
+  // Writes the events of all threads. Rings of threads still recording may
+  // lose their oldest events to the writer, call it while the threads are
+  // idle for a complete trace.
+  static bool WriteTrace(const char* path);
+
+  struct Scope
+  {
+    const char* name;
+    uint64_t beginNs;
+
+    explicit Scope(const char* name)
+      : name(name)
+      , beginNs(IsEnabled() ? Now() : 0)
+    {}
+
+    ~Scope()
+    {
+      if (beginNs != 0) {
+        Record(name, beginNs, Now());
+      }
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+  };
+
+private:
+  static std::atomic<bool> enabled;
+};
+
+#define CPU_PROFILER_CONCAT_(a, b) a##b
+#define CPU_PROFILER_CONCAT(a, b) CPU_PROFILER_CONCAT_(a, b)
+#define PROFILE_SCOPE(name)                                                    \
+  CpuProfiler::Scope CPU_PROFILER_CONCAT(profileScope, __LINE__)(name)
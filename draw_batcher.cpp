@@ -0,0 +1,55 @@
+#include "draw_batcher.h"
+
+#include <algorithm>
+
+std::vector<DrawBatcher::Batch>
+DrawBatcher::Build(std::vector<Draw>& draws,
+                   std::vector<VkDrawIndexedIndirectCommand>& commands)
+{
+  std::stable_sort(
+    draws.begin(), draws.end(), [](const Draw& a, const Draw& b) {
+      if (a.pipelineIdx != b.pipelineIdx)
+        return a.pipelineIdx < b.pipelineIdx;
+      return a.meshIdx < b.meshIdx;
+    });
+
+  std::vector<Batch> batches;
+  commands.resize(draws.size());
+
+  for (size_t i = 0; i < draws.size(); ++i) {
+    const Draw& draw = draws[i];
+    commands[i] = draw.command;
+
+    if (batches.empty() || batches.back().pipelineIdx != draw.pipelineIdx ||
+        batches.back().meshIdx != draw.meshIdx) {
+      Batch batch;
+      batch.pipelineIdx = draw.pipelineIdx;
+      batch.meshIdx = draw.meshIdx;
+      batch.firstCommand = static_cast<uint32_t>(i);
+      batches.push_back(batch);
+    }
+    ++batches.back().commandCount;
+  }
+
+  return batches;
+}
+
+void
+DrawBatcher::CmdDraw(VkCommandBuffer cmd,
+                     VkBuffer buffer,
+                     const Batch& batch,
+                     bool multiDrawIndirect,
+                     uint32_t maxDrawCount)
+{
+  const VkDeviceSize stride = sizeof(VkDrawIndexedIndirectCommand);
+  uint32_t callSize = multiDrawIndirect ? std::max(maxDrawCount, 1u) : 1;
+
+  for (uint32_t first = 0; first < batch.commandCount; first += callSize) {
+    uint32_t count = std::min(callSize, batch.commandCount - first);
+    vkCmdDrawIndexedIndirect(cmd,
+                             buffer,
+                             (batch.firstCommand + first) * stride,
+                             count,
+                             static_cast<uint32_t>(stride));
+  }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Groups indexed draws into batches for vkCmdDrawIndexedIndirect. Draws are
+// sorted by pipeline and then by mesh, so each batch needs one set of binds
+// and one indirect call. The commands are laid out batch by batch in a
+// single buffer, which usually lives on the GPU.
+struct DrawBatcher
+{
+  struct Draw
+  {
+    // Caller-defined keys, e.g. indices into the caller's pipeline and mesh
+    // lists.
+    uint32_t pipelineIdx = 0;
+    uint32_t meshIdx = 0;
+    VkDrawIndexedIndirectCommand command = {};
+  };
+
+  struct Batch
+  {
+    uint32_t pipelineIdx = 0;
+    uint32_t meshIdx = 0;
+    uint32_t firstCommand = 0;
+    uint32_t commandCount = 0;
+  };
+
+  // Sorts draws in place, keeping the submission order within a batch, and
+  // writes their commands.
+  static std::vector<Batch> Build(
+    std::vector<Draw>& draws,
+    std::vector<VkDrawIndexedIndirectCommand>& commands);
+
+  // Issues a batch's commands read from buffer. Without multiDrawIndirect a
+  // call may only draw one command, then one call per command is issued.
+  // maxDrawCount is VkPhysicalDeviceLimits::maxDrawIndirectCount.
+  static void CmdDraw(VkCommandBuffer cmd,
+                      VkBuffer buffer,
+                      const Batch& batch,
+                      bool multiDrawIndirect,
+                      uint32_t maxDrawCount);
+};
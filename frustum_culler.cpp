@@ -0,0 +1,257 @@
+#include "frustum_culler.h"
+
+#include <algorithm>
+#include <cfloat>
+
+#include "cpu_profiler.h"
+
+#if defined(__SSE__) || defined(_M_X64) ||                                     \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRUSTUM_CULLER_SSE
+#include <xmmintrin.h>
+#endif
+
+// The AVX loop is compiled whenever the compiler can emit AVX for a single
+// function and only runs on CPUs that support it, so builds need no /arch or
+// -m flags for it.
+#if defined(__AVX__)
+#define FRUSTUM_CULLER_AVX
+#define FRUSTUM_CULLER_AVX_TARGET
+#include <immintrin.h>
+#elif defined(FRUSTUM_CULLER_SSE) && defined(_MSC_VER)
+#define FRUSTUM_CULLER_AVX
+#define FRUSTUM_CULLER_AVX_TARGET
+#include <immintrin.h>
+#include <intrin.h>
+#elif defined(FRUSTUM_CULLER_SSE) && defined(__GNUC__)
+#define FRUSTUM_CULLER_AVX
+#define FRUSTUM_CULLER_AVX_TARGET __attribute__((target("avx")))
+#include <immintrin.h>
+#endif
+
+#if defined(FRUSTUM_CULLER_AVX)
+static bool
+cpuSupportsAvx()
+{
+#if defined(__AVX__)
+  return true;
+#elif defined(_MSC_VER)
+  // The CPU must support AVX and the OS must save the YMM registers.
+  int info[4];
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+  return osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx");
+#endif
+}
+
+// Checked once, the first time it is needed.
+static bool
+useAvx()
+{
+  static const bool supported = cpuSupportsAvx();
+  return supported;
+}
+#endif
+
+uint32_t
+FrustumCuller::GetWidth()
+{
+#if defined(FRUSTUM_CULLER_AVX)
+  if (useAvx())
+    return 8;
+#endif
+#if defined(FRUSTUM_CULLER_SSE)
+  return 4;
+#else
+  return 1;
+#endif
+}
+
+// Every SIMD width divides it.
+static const uint32_t kPadding = 8;
+
+void
+FrustumCuller::ExtractPlanes(const glm::mat4& projView, glm::vec4 planes[6])
+{
+  glm::mat4 m = glm::transpose(projView);
+  planes[0] = m[3] + m[0];
+  planes[1] = m[3] - m[0];
+  planes[2] = m[3] + m[1];
+  planes[3] = m[3] - m[1];
+  planes[4] = m[3] + m[2];
+  planes[5] = m[3] - m[2];
+
+  // Distances to normalized planes compare directly with radii.
+  for (int p = 0; p < 6; ++p) {
+    planes[p] /= glm::length(glm::vec3(planes[p]));
+  }
+}
+
+void
+FrustumCuller::SetSpheres(const glm::vec4* spheres, uint32_t count)
+{
+  this->count = count;
+
+  // Padding spheres sit behind every plane.
+  uint32_t padded = (count + kPadding - 1) / kPadding * kPadding;
+  centerX.assign(padded, 0.0f);
+  centerY.assign(padded, 0.0f);
+  centerZ.assign(padded, 0.0f);
+  radius.assign(padded, -FLT_MAX);
+
+  for (uint32_t i = 0; i < count; ++i) {
+    centerX[i] = spheres[i].x;
+    centerY[i] = spheres[i].y;
+    centerZ[i] = spheres[i].z;
+    radius[i] = spheres[i].w;
+  }
+}
+
+uint32_t
+FrustumCuller::CullScalar(const glm::mat4& projView, uint32_t* visible) const
+{
+  PROFILE_SCOPE("FrustumCuller::CullScalar");
+  glm::vec4 planes[6];
+  ExtractPlanes(projView, planes);
+
+  uint32_t visibleCount = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    glm::vec3 center(centerX[i], centerY[i], centerZ[i]);
+
+    bool inside = true;
+    for (int p = 0; p < 6 && inside; ++p) {
+      inside = glm::dot(glm::vec3(planes[p]), center) + planes[p].w >=
+               -radius[i];
+    }
+
+    if (inside) {
+      visible[visibleCount++] = i;
+    }
+  }
+
+  return visibleCount;
+}
+
+// Appends the indices of the set bits of mask, lanes past count excluded.
+// Written unconditionally and kept by advancing, so visibility does not
+// cost a mispredicted branch.
+static uint32_t
+appendVisible(uint32_t* visible,
+              uint32_t visibleCount,
+              uint32_t first,
+              uint32_t width,
+              uint32_t count,
+              int mask)
+{
+  uint32_t lanes = std::min(width, count - first);
+  for (uint32_t lane = 0; lane < lanes; ++lane) {
+    visible[visibleCount] = first + lane;
+    visibleCount += (mask >> lane) & 1;
+  }
+  return visibleCount;
+}
+
+#if defined(FRUSTUM_CULLER_AVX)
+FRUSTUM_CULLER_AVX_TARGET static uint32_t
+cullAvx(const glm::vec4 planes[6],
+        const float* centerX,
+        const float* centerY,
+        const float* centerZ,
+        const float* radius,
+        uint32_t count,
+        uint32_t* visible)
+{
+  uint32_t visibleCount = 0;
+  for (uint32_t i = 0; i < count; i += 8) {
+    __m256 x = _mm256_loadu_ps(&centerX[i]);
+    __m256 y = _mm256_loadu_ps(&centerY[i]);
+    __m256 z = _mm256_loadu_ps(&centerZ[i]);
+    __m256 negRadius =
+      _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&radius[i]));
+
+    int mask = 0xff;
+    for (int p = 0; p < 6; ++p) {
+      __m256 distance = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(planes[p].x)),
+                      _mm256_mul_ps(y, _mm256_set1_ps(planes[p].y))),
+        _mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(planes[p].z)),
+                      _mm256_set1_ps(planes[p].w)));
+      mask &=
+        _mm256_movemask_ps(_mm256_cmp_ps(distance, negRadius, _CMP_GE_OQ));
+    }
+
+    visibleCount = appendVisible(visible, visibleCount, i, 8, count, mask);
+  }
+
+  return visibleCount;
+}
+#endif
+
+#if defined(FRUSTUM_CULLER_SSE)
+static uint32_t
+cullSse(const glm::vec4 planes[6],
+        const float* centerX,
+        const float* centerY,
+        const float* centerZ,
+        const float* radius,
+        uint32_t count,
+        uint32_t* visible)
+{
+  uint32_t visibleCount = 0;
+  for (uint32_t i = 0; i < count; i += 4) {
+    __m128 x = _mm_loadu_ps(&centerX[i]);
+    __m128 y = _mm_loadu_ps(&centerY[i]);
+    __m128 z = _mm_loadu_ps(&centerZ[i]);
+    __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&radius[i]));
+
+    int mask = 0xf;
+    for (int p = 0; p < 6; ++p) {
+      __m128 distance =
+        _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(planes[p].x)),
+                              _mm_mul_ps(y, _mm_set1_ps(planes[p].y))),
+                   _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(planes[p].z)),
+                              _mm_set1_ps(planes[p].w)));
+      mask &= _mm_movemask_ps(_mm_cmpge_ps(distance, negRadius));
+    }
+
+    visibleCount = appendVisible(visible, visibleCount, i, 4, count, mask);
+  }
+
+  return visibleCount;
+}
+#endif
+
+uint32_t
+FrustumCuller::Cull(const glm::mat4& projView, uint32_t* visible) const
+{
+#if defined(FRUSTUM_CULLER_SSE)
+  PROFILE_SCOPE("FrustumCuller::Cull");
+  glm::vec4 planes[6];
+  ExtractPlanes(projView, planes);
+
+#if defined(FRUSTUM_CULLER_AVX)
+  if (useAvx()) {
+    return cullAvx(planes,
+                   centerX.data(),
+                   centerY.data(),
+                   centerZ.data(),
+                   radius.data(),
+                   count,
+                   visible);
+  }
+#endif
+  return cullSse(planes,
+                 centerX.data(),
+                 centerY.data(),
+                 centerZ.data(),
+                 radius.data(),
+                 count,
+                 visible);
+#else
+  return CullScalar(projView, visible);
+#endif
+}
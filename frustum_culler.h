@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Frustum culling of bounding spheres on the CPU, for devices or settings
+// that cannot use GpuCuller. Spheres are kept as structure of arrays, so
+// Cull() tests 8 of them per instruction with AVX, picked at runtime on CPUs
+// that support it, or 4 with SSE against each plane. Builds for targets
+// without SSE use the scalar loop of CullScalar().
+struct FrustumCuller
+{
+  // Spheres tested at once by Cull() on this CPU, 1 without SIMD.
+  static uint32_t GetWidth();
+
+  // Gribb-Hartmann planes of projView, normalized and pointing inward:
+  // left, right, bottom, top, near, far. The near plane is the one of a
+  // -1..1 depth range, which also holds for 0..1.
+  static void ExtractPlanes(const glm::mat4& projView, glm::vec4 planes[6]);
+
+  // Replaces all spheres, center in xyz and radius in w, in world space.
+  void SetSpheres(const glm::vec4* spheres, uint32_t count);
+  uint32_t GetCount() const { return count; }
+
+  // Writes the indices of the spheres touching the frustum to visible in
+  // ascending order and returns how many there are. visible must hold
+  // GetCount() indices.
+  uint32_t Cull(const glm::mat4& projView, uint32_t* visible) const;
+  // Same as Cull() one sphere at a time with glm, the reference it is
+  // measured against.
+  uint32_t CullScalar(const glm::mat4& projView, uint32_t* visible) const;
+
+private:
+  uint32_t count = 0;
+  // Padded to a multiple of 8 with spheres that are never visible.
+  std::vector<float> centerX = {};
+  std::vector<float> centerY = {};
+  std::vector<float> centerZ = {};
+  std::vector<float> radius = {};
+};
@@ -0,0 +1,213 @@
+#include "gpu_culler.h"
+
+#include "vk_init.h"
+#include "vk_utils.h"
+
+// Workgroup size of cull.comp, the shader gets it as a specialization
+// constant.
+static const uint32_t kGroupSize = 64;
+
+struct CullConstants
+{
+  glm::vec4 boundingSphere;
+  uint32_t instanceCount;
+};
+
+GpuCuller::GpuCuller(VkDevice device,
+                     MemoryAllocator* allocator,
+                     VkPipelineCache pipelineCache,
+                     PipelineObjectCache* objectCache,
+                     const VkDescriptorBufferInfo& camera,
+                     uint32_t frameCount,
+                     bool async,
+                     const std::vector<uint32_t>& queueFamilies)
+  : device(device)
+  , allocator(allocator)
+  , outputs(frameCount)
+  , queueFamilies(queueFamilies)
+  , async(async)
+{
+  shaderModule = vkuLoadShaderModule(device, "cull.comp.spv");
+  ASSERT_VK_VALID_HANDLE(shaderModule);
+
+  std::vector<VkDescriptorSetLayoutBinding> bindings = {
+    vkiDescriptorSetLayoutBinding(0,
+                                  VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                                  1,
+                                  VK_SHADER_STAGE_COMPUTE_BIT,
+                                  nullptr),
+    vkiDescriptorSetLayoutBinding(1,
+                                  VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                  1,
+                                  VK_SHADER_STAGE_COMPUTE_BIT,
+                                  nullptr),
+    vkiDescriptorSetLayoutBinding(2,
+                                  VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                  1,
+                                  VK_SHADER_STAGE_COMPUTE_BIT,
+                                  nullptr),
+    vkiDescriptorSetLayoutBinding(3,
+                                  VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                  1,
+                                  VK_SHADER_STAGE_COMPUTE_BIT,
+                                  nullptr)
+  };
+
+  pipeline = ComputePipeline::GetBuilder()
+               .SetDevice(device)
+               .SetShader(shaderModule)
+               .SetDescriptorSetLayouts({ bindings })
+               .SetPushConstantRanges({ { VK_SHADER_STAGE_COMPUTE_BIT,
+                                          0,
+                                          sizeof(CullConstants) } })
+               .SetLocalSize(kGroupSize)
+               .SetPipelineCache(pipelineCache)
+               .SetObjectCache(objectCache)
+               .Build();
+  ASSERT_VK_VALID_HANDLE(pipeline->pipeline);
+
+  VkDescriptorPoolSize poolSizes[] = {
+    vkiDescriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                          frameCount),
+    vkiDescriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 * frameCount)
+  };
+  auto poolInfo = vkiDescriptorPoolCreateInfo(frameCount, 2, poolSizes);
+  ASSERT_VK_SUCCESS(
+    vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool));
+
+  for (auto& output : outputs) {
+    auto allocateInfo = vkiDescriptorSetAllocateInfo(
+      descriptorPool, 1, &pipeline->descriptorSetLayouts[0]);
+    ASSERT_VK_SUCCESS(
+      vkAllocateDescriptorSets(device, &allocateInfo, &output.descriptorSet));
+
+    auto write =
+      vkiWriteDescriptorSet(output.descriptorSet,
+                            0,
+                            0,
+                            1,
+                            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                            nullptr,
+                            &camera,
+                            nullptr);
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  }
+}
+
+GpuCuller::~GpuCuller()
+{
+  DestroyBuffers();
+  vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  pipeline = nullptr;
+  vkDestroyShaderModule(device, shaderModule, nullptr);
+}
+
+void
+GpuCuller::DestroyBuffers()
+{
+  for (auto& output : outputs) {
+    vkDestroyBuffer(device, output.visibleBuffer, nullptr);
+    allocator->Free(output.visibleAllocation);
+    vkDestroyBuffer(device, output.drawCommandBuffer, nullptr);
+    allocator->Free(output.drawCommandAllocation);
+
+    output.visibleBuffer = VK_NULL_HANDLE;
+    output.visibleAllocation = {};
+    output.drawCommandBuffer = VK_NULL_HANDLE;
+    output.drawCommandAllocation = {};
+  }
+}
+
+void
+GpuCuller::SetInstances(VkBuffer instances, uint32_t instanceCount)
+{
+  ASSERT_TRUE(instanceCount > 0);
+  DestroyBuffers();
+  this->instanceCount = instanceCount;
+
+  VkSharingMode sharingMode = queueFamilies.size() > 1
+                                ? VK_SHARING_MODE_CONCURRENT
+                                : VK_SHARING_MODE_EXCLUSIVE;
+  VkDeviceSize visibleSize = instanceCount * sizeof(glm::mat4);
+
+  for (auto& output : outputs) {
+    output.visibleBuffer =
+      vkuCreateBuffer(device,
+                      visibleSize,
+                      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT |
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                      sharingMode,
+                      queueFamilies);
+    output.visibleAllocation = allocator->AllocateForBuffer(
+      output.visibleBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    ASSERT_TRUE(output.visibleAllocation.IsValid());
+
+    output.drawCommandBuffer =
+      vkuCreateBuffer(device,
+                      sizeof(VkDrawIndexedIndirectCommand),
+                      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                      sharingMode,
+                      queueFamilies);
+    output.drawCommandAllocation = allocator->AllocateForBuffer(
+      output.drawCommandBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    ASSERT_TRUE(output.drawCommandAllocation.IsValid());
+
+    VkDescriptorBufferInfo bufferInfos[] = {
+      { instances, 0, visibleSize },
+      { output.visibleBuffer, 0, visibleSize },
+      { output.drawCommandBuffer, 0, sizeof(VkDrawIndexedIndirectCommand) }
+    };
+    auto write = vkiWriteDescriptorSet(output.descriptorSet,
+                                       1,
+                                       0,
+                                       3,
+                                       VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                       nullptr,
+                                       bufferInfos,
+                                       nullptr);
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+  }
+}
+
+void
+GpuCuller::CmdCull(VkCommandBuffer cmd,
+                   uint32_t frameIdx,
+                   uint32_t cameraOffset,
+                   glm::vec4 boundingSphere,
+                   uint32_t indexCount)
+{
+  // The slot's fence signalled, no draw reads these outputs any more.
+  const Output& output = outputs[frameIdx];
+
+  VkDrawIndexedIndirectCommand command = { indexCount, 0, 0, 0, 0 };
+  vkCmdUpdateBuffer(
+    cmd, output.drawCommandBuffer, 0, sizeof(command), &command);
+
+  vkuCmdMemoryBarrier(cmd,
+                      VK_PIPELINE_STAGE_TRANSFER_BIT,
+                      VK_ACCESS_TRANSFER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+  CullConstants constants = { boundingSphere, instanceCount };
+  pipeline->CmdBind(cmd);
+  pipeline->CmdBindDescriptorSets(
+    cmd, 0, { output.descriptorSet }, { cameraOffset });
+  pipeline->CmdPushConstants(cmd, 0, sizeof(constants), &constants);
+  pipeline->CmdDispatch(cmd, instanceCount);
+
+  // The draws' semaphore wait covers async passes, a compute queue could
+  // not wait for vertex input anyway.
+  if (async)
+    return;
+
+  vkuCmdMemoryBarrier(cmd,
+                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                      VK_ACCESS_SHADER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                      VK_ACCESS_INDIRECT_COMMAND_READ_BIT |
+                        VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+}
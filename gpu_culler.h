@@ -0,0 +1,77 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <memory>
+#include <vulkan/vulkan.h>
+
+#include "compute_pipeline.h"
+#include "memory_allocator.h"
+
+// Frustum culling in a compute pass. Instances are read from a buffer of
+// model matrices, the visible ones are compacted into a visible buffer and
+// counted in the instanceCount of a draw command buffer, a single
+// VkDrawIndexedIndirectCommand. Drawing the mesh indirectly from it with the
+// visible buffer as instance data draws only what the camera sees, without
+// a round trip to the CPU.
+//
+// Every frame slot has its own outputs, they are rewritten only after the
+// slot's fence signalled. The pass of the next frame can therefore run on
+// another queue while the current frame still draws from its outputs.
+struct GpuCuller
+{
+  struct Output
+  {
+    VkBuffer visibleBuffer = VK_NULL_HANDLE;
+    MemoryAllocator::Allocation visibleAllocation = {};
+    VkBuffer drawCommandBuffer = VK_NULL_HANDLE;
+    MemoryAllocator::Allocation drawCommandAllocation = {};
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+  };
+
+  VkDevice device = VK_NULL_HANDLE;
+  MemoryAllocator* allocator = nullptr;
+
+  VkShaderModule shaderModule = VK_NULL_HANDLE;
+  std::shared_ptr<ComputePipeline> pipeline = nullptr;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+
+  // One per frame slot.
+  std::vector<Output> outputs = {};
+  uint32_t instanceCount = 0;
+  // Families sharing the outputs, see the constructor.
+  std::vector<uint32_t> queueFamilies = {};
+  bool async = false;
+
+  // camera is the dynamic uniform buffer holding the view projection matrix.
+  // async passes run on a queue other than the draws', which wait on a
+  // semaphore instead of a barrier. With more than one entry in
+  // queueFamilies the outputs are shared concurrently by those families.
+  GpuCuller(VkDevice device,
+            MemoryAllocator* allocator,
+            VkPipelineCache pipelineCache,
+            PipelineObjectCache* objectCache,
+            const VkDescriptorBufferInfo& camera,
+            uint32_t frameCount,
+            bool async,
+            const std::vector<uint32_t>& queueFamilies = {});
+
+  GpuCuller(const GpuCuller&) = delete;
+  GpuCuller& operator=(const GpuCuller&) = delete;
+
+  ~GpuCuller();
+
+  // instances needs STORAGE_BUFFER usage. Reallocates the outputs, none of
+  // them may be in use.
+  void SetInstances(VkBuffer instances, uint32_t instanceCount);
+
+  // Records the pass of frame slot frameIdx, outside of a render pass.
+  // boundingSphere is the mesh's center and radius in model space.
+  void CmdCull(VkCommandBuffer cmd,
+               uint32_t frameIdx,
+               uint32_t cameraOffset,
+               glm::vec4 boundingSphere,
+               uint32_t indexCount);
+
+private:
+  void DestroyBuffers();
+};
@@ -0,0 +1,245 @@
+#include "gpu_profiler.h"
+
+#include <cstring>
+
+#include "vk_init.h"
+#include "vk_utils.h"
+
+static const VkQueryPipelineStatisticFlags kStatisticFlags =
+  VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+  VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+  VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+  VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+  VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+  VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+// Counters in the order of the bits above, followed by the availability.
+static const uint32_t kStatisticCount = 6;
+
+GpuProfiler::GpuProfiler(VkDevice device,
+                         const VkPhysicalDeviceProperties& props,
+                         bool pipelineStatistics,
+                         uint32_t timestampValidBits,
+                         uint32_t frameCount,
+                         uint32_t maxScopes)
+  : device(device)
+  , frameCount(frameCount)
+  , maxScopes(maxScopes)
+  , timestampPeriod(props.limits.timestampPeriod)
+{
+  if (timestampValidBits == 0)
+    return;
+
+  timestampMask =
+    timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+
+  // Two timestamps per scope.
+  auto info = vkiQueryPoolCreateInfo(
+    VK_QUERY_TYPE_TIMESTAMP, 2 * maxScopes * frameCount, 0);
+  ASSERT_VK_SUCCESS(vkCreateQueryPool(device, &info, nullptr, &timestampPool));
+
+  if (pipelineStatistics) {
+    info = vkiQueryPoolCreateInfo(VK_QUERY_TYPE_PIPELINE_STATISTICS,
+                                  maxScopes * frameCount,
+                                  kStatisticFlags);
+    ASSERT_VK_SUCCESS(
+      vkCreateQueryPool(device, &info, nullptr, &statisticsPool));
+  }
+
+  slots.resize(frameCount);
+}
+
+GpuProfiler::~GpuProfiler()
+{
+  vkDestroyQueryPool(device, statisticsPool, nullptr);
+  vkDestroyQueryPool(device, timestampPool, nullptr);
+}
+
+void
+GpuProfiler::BeginFrame(uint32_t frameIdx)
+{
+  this->frameIdx = frameIdx;
+  if (!IsSupported())
+    return;
+
+  Slot& slot = slots[frameIdx];
+  if (slot.scopes.empty())
+    return;
+
+  ASSERT_TRUE(slot.depth == 0);
+
+  uint32_t scopeCount = static_cast<uint32_t>(slot.scopes.size());
+  uint32_t firstQuery = GetFirstQuery(frameIdx);
+
+  // Value and availability per query, no VK_QUERY_RESULT_WAIT_BIT.
+  std::vector<uint64_t> timestamps(4 * scopeCount);
+  VkResult result = vkGetQueryPoolResults(
+    device,
+    timestampPool,
+    2 * firstQuery,
+    2 * scopeCount,
+    timestamps.size() * sizeof(uint64_t),
+    timestamps.data(),
+    2 * sizeof(uint64_t),
+    VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+  std::vector<uint64_t> statistics((kStatisticCount + 1) *
+                                   slot.statisticsCount);
+  if (result >= 0 && slot.statisticsCount > 0) {
+    result = vkGetQueryPoolResults(
+      device,
+      statisticsPool,
+      firstQuery,
+      slot.statisticsCount,
+      statistics.size() * sizeof(uint64_t),
+      statistics.data(),
+      (kStatisticCount + 1) * sizeof(uint64_t),
+      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+  }
+
+  // VK_NOT_READY is expected, availability decides per query.
+  if (result < 0) {
+    slot.scopes.clear();
+    slot.statisticsCount = 0;
+    return;
+  }
+
+  std::vector<ScopeResult> frameResults(scopeCount);
+  bool available = true;
+
+  for (uint32_t i = 0; i < scopeCount; ++i) {
+    const Scope& scope = slot.scopes[i];
+    const uint64_t* begin = &timestamps[4 * i];
+    const uint64_t* end = &timestamps[4 * i + 2];
+    available = available && begin[1] != 0 && end[1] != 0;
+
+    ScopeResult& scopeResult = frameResults[i];
+    scopeResult.name = scope.name;
+    scopeResult.depth = scope.depth;
+    scopeResult.gpuMs =
+      ((end[0] - begin[0]) & timestampMask) * timestampPeriod * 1e-6;
+
+    if (scope.statisticsQuery != (uint32_t)-1) {
+      const uint64_t* values =
+        &statistics[(kStatisticCount + 1) * scope.statisticsQuery];
+      available = available && values[kStatisticCount] != 0;
+
+      scopeResult.hasStatistics = true;
+      scopeResult.statistics.inputAssemblyVertices = values[0];
+      scopeResult.statistics.inputAssemblyPrimitives = values[1];
+      scopeResult.statistics.vertexShaderInvocations = values[2];
+      scopeResult.statistics.clippingInvocations = values[3];
+      scopeResult.statistics.clippingPrimitives = values[4];
+      scopeResult.statistics.fragmentShaderInvocations = values[5];
+    }
+  }
+
+  if (available) {
+    results.swap(frameResults);
+  }
+
+  slot.scopes.clear();
+  slot.statisticsCount = 0;
+}
+
+void
+GpuProfiler::CmdReset(VkCommandBuffer cmd)
+{
+  if (!IsSupported())
+    return;
+
+  uint32_t firstQuery = GetFirstQuery(frameIdx);
+  vkCmdResetQueryPool(cmd, timestampPool, 2 * firstQuery, 2 * maxScopes);
+  if (statisticsPool != VK_NULL_HANDLE) {
+    vkCmdResetQueryPool(cmd, statisticsPool, firstQuery, maxScopes);
+  }
+}
+
+uint32_t
+GpuProfiler::CmdBeginScope(VkCommandBuffer cmd,
+                           const char* name,
+                           bool statistics)
+{
+  if (!IsSupported())
+    return (uint32_t)-1;
+
+  Slot& slot = slots[frameIdx];
+  ASSERT_TRUE(slot.scopes.size() < maxScopes);
+
+  Scope scope;
+  scope.name = name;
+  scope.depth = slot.depth++;
+
+  uint32_t scopeIdx = static_cast<uint32_t>(slot.scopes.size());
+  uint32_t firstQuery = GetFirstQuery(frameIdx);
+
+  vkCmdWriteTimestamp(cmd,
+                      VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      timestampPool,
+                      2 * (firstQuery + scopeIdx));
+
+  if (statistics && statisticsPool != VK_NULL_HANDLE) {
+    scope.statisticsQuery = slot.statisticsCount++;
+    vkCmdBeginQuery(
+      cmd, statisticsPool, firstQuery + scope.statisticsQuery, 0);
+  }
+
+  slot.scopes.push_back(scope);
+  return scopeIdx;
+}
+
+void
+GpuProfiler::CmdEndScope(VkCommandBuffer cmd, uint32_t scopeIdx)
+{
+  if (!IsSupported())
+    return;
+
+  Slot& slot = slots[frameIdx];
+  const Scope& scope = slot.scopes[scopeIdx];
+  uint32_t firstQuery = GetFirstQuery(frameIdx);
+
+  if (scope.statisticsQuery != (uint32_t)-1) {
+    vkCmdEndQuery(cmd, statisticsPool, firstQuery + scope.statisticsQuery);
+  }
+
+  vkCmdWriteTimestamp(cmd,
+                      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      timestampPool,
+                      2 * (firstQuery + scopeIdx) + 1);
+  --slot.depth;
+}
+
+const std::vector<GpuProfiler::Scope>&
+GpuProfiler::GetFrameScopes() const
+{
+  static const std::vector<Scope> none;
+  return IsSupported() ? slots[frameIdx].scopes : none;
+}
+
+void
+GpuProfiler::ReplayScopes(const std::vector<Scope>& scopes)
+{
+  if (!IsSupported())
+    return;
+
+  Slot& slot = slots[frameIdx];
+  ASSERT_TRUE(slot.scopes.empty());
+
+  slot.scopes = scopes;
+  slot.statisticsCount = 0;
+  for (const auto& scope : scopes) {
+    if (scope.statisticsQuery != (uint32_t)-1) {
+      ++slot.statisticsCount;
+    }
+  }
+}
+
+double
+GpuProfiler::GetScopeMs(const char* name) const
+{
+  for (const auto& result : results) {
+    if (result.depth == 0 && strcmp(result.name, name) == 0)
+      return result.gpuMs;
+  }
+  return -1.0;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Named GPU scopes measured with timestamp queries, optionally with pipeline
+// statistics. Every frame in flight owns its own range of queries, so a
+// frame's results are read back once its slot comes around again, after the
+// slot's fence signalled. Reads never wait; results that are not available
+// yet are skipped and the previous breakdown stays in place.
+//
+// Per frame: BeginFrame() on the host, CmdReset() before the frame's first
+// scope on the queue, then any number of possibly nested scopes in command
+// buffers submitted to the same queue after the reset.
+struct GpuProfiler
+{
+  struct PipelineStatistics
+  {
+    uint64_t inputAssemblyVertices = 0;
+    uint64_t inputAssemblyPrimitives = 0;
+    uint64_t vertexShaderInvocations = 0;
+    uint64_t clippingInvocations = 0;
+    uint64_t clippingPrimitives = 0;
+    uint64_t fragmentShaderInvocations = 0;
+  };
+
+  struct ScopeResult
+  {
+    const char* name = nullptr;
+    // Nesting level, 0 for outermost scopes.
+    uint32_t depth = 0;
+    double gpuMs = 0.0;
+    bool hasStatistics = false;
+    PipelineStatistics statistics = {};
+  };
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkQueryPool timestampPool = VK_NULL_HANDLE;
+  // VK_NULL_HANDLE if the device lacks pipelineStatisticsQuery.
+  VkQueryPool statisticsPool = VK_NULL_HANDLE;
+  uint32_t frameCount = 0;
+  uint32_t maxScopes = 0;
+  double timestampPeriod = 0.0;
+  uint64_t timestampMask = 0;
+
+  // timestampValidBits of the queue family the scopes are recorded for, the
+  // profiler does nothing if it is zero.
+  GpuProfiler(VkDevice device,
+              const VkPhysicalDeviceProperties& props,
+              bool pipelineStatistics,
+              uint32_t timestampValidBits,
+              uint32_t frameCount,
+              uint32_t maxScopes = 32);
+
+  GpuProfiler(const GpuProfiler&) = delete;
+  GpuProfiler& operator=(const GpuProfiler&) = delete;
+
+  ~GpuProfiler();
+
+  bool IsSupported() const { return timestampPool != VK_NULL_HANDLE; }
+
+  // Collects the results the slot's previous frame left behind. Call once
+  // the slot's fence signalled.
+  void BeginFrame(uint32_t frameIdx);
+  void CmdReset(VkCommandBuffer cmd);
+
+  // name must outlive the results, pass string literals. Returns the scope
+  // to pass to CmdEndScope. Statistics scopes must begin and end in the same
+  // subpass when used inside a render pass, and must not nest.
+  uint32_t CmdBeginScope(VkCommandBuffer cmd,
+                         const char* name,
+                         bool statistics = false);
+  void CmdEndScope(VkCommandBuffer cmd, uint32_t scope);
+
+  struct Scope
+  {
+    const char* name = nullptr;
+    uint32_t depth = 0;
+    uint32_t statisticsQuery = (uint32_t)-1;
+  };
+
+  // Scopes recorded for the current frame so far. A command buffer that is
+  // submitted again without being rerecorded writes the same queries of the
+  // same slot; hand its scopes back with ReplayScopes after BeginFrame so
+  // their results are read.
+  const std::vector<Scope>& GetFrameScopes() const;
+  void ReplayScopes(const std::vector<Scope>& scopes);
+
+  // Breakdown of the latest frame whose results came back, in the order the
+  // scopes began.
+  const std::vector<ScopeResult>& GetResults() const { return results; }
+  // Time of the first outermost scope called name, -1 if there is none.
+  double GetScopeMs(const char* name) const;
+
+private:
+  struct Slot
+  {
+    std::vector<Scope> scopes = {};
+    uint32_t statisticsCount = 0;
+    uint32_t depth = 0;
+  };
+
+  std::vector<Slot> slots = {};
+  uint32_t frameIdx = 0;
+  std::vector<ScopeResult> results = {};
+
+  uint32_t GetFirstQuery(uint32_t frameIdx) const
+  {
+    return frameIdx * maxScopes;
+  }
+};
@@ -1,13 +1,13 @@
 #include "graphics_pipeline.h"
 
+#include <algorithm>
+
+#include "cpu_profiler.h"
+#include "pipeline_key.h"
+
 GraphicsPipeline::~GraphicsPipeline()
 {
   vkDestroyPipeline(device, pipeline, nullptr);
-  vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-
-  for (auto dsl : descriptorSetLayouts) {
-    vkDestroyDescriptorSetLayout(device, dsl, nullptr);
-  }
 }
 
 GraphicsPipeline::Builder
@@ -16,34 +16,89 @@ GraphicsPipeline::GetBuilder()
   return Builder();
 }
 
-GraphicsPipeline*
+std::string
+GraphicsPipeline::Builder::GetKey(VkPipelineLayout pipelineLayout) const
+{
+  KeyWriter key;
+  key.Write(Device);
+  key.Write(pipelineLayout);
+  key.Write(VertexShader);
+  key.Write(FragmentShader);
+  key.Write(VertexBindings);
+  key.Write(VertexAttributes);
+  key.Write(PrimitiveTopology);
+  key.Write(PrimitiveRestartEnable);
+  key.Write(PatchControlPoints);
+  key.Write(Viewports);
+  key.Write(Scissors);
+  key.Write(DepthClampEnable);
+  key.Write(RasterizerDiscardEnable);
+  key.Write(PolygonMode);
+  key.Write(CullMode);
+  key.Write(FrontFace);
+  key.Write(DepthBiasEnable);
+  key.Write(DepthBiasConstantFactor);
+  key.Write(DepthBiasClamp);
+  key.Write(DepthBiasSlopeFactor);
+  key.Write(LineWidth);
+  key.Write(RasterizationSamples);
+  key.Write(SampleShadingEnable);
+  key.Write(MinSampleShading);
+  key.Write(SampleMaskEnable);
+  key.Write(SampleMask);
+  key.Write(AlphaToCoverageEnable);
+  key.Write(AlphaToOneEnable);
+  key.Write(DepthTestEnable);
+  key.Write(DepthWriteEnable);
+  key.Write(DepthCompareOp);
+  key.Write(DepthBoundsTestEnable);
+  key.Write(StencilTestEnable);
+  key.Write(Front);
+  key.Write(Back);
+  key.Write(MinDepthBounds);
+  key.Write(MaxDepthBounds);
+  key.Write(LogicOpEnable);
+  key.Write(LogicOp);
+  key.Write(ColorBlendAttachments);
+  key.Write(BlendConstants);
+  key.Write(DynamicStates);
+  key.Write(RenderPass);
+  key.Write(Subpass);
+  key.Write(BasePipelineHandle);
+  key.Write(BasePipelineIndex);
+  return key.bytes;
+}
+
+std::shared_ptr<GraphicsPipeline>
 GraphicsPipeline::Builder::Build()
 {
-  GraphicsPipeline* graphicsPipeline = new GraphicsPipeline;
-
-  graphicsPipeline->descriptorSetLayouts.resize(DescriptorSetLayouts.size());
-  uint32_t i = 0;
-
-  for (auto bindings : DescriptorSetLayouts) {
-    auto info = vkiDescriptorSetLayoutCreateInfo(
-      static_cast<uint32_t>(bindings.size()), bindings.data());
-    vkCreateDescriptorSetLayout(
-      Device, &info, nullptr, &graphicsPipeline->descriptorSetLayouts[i]);
-    SharedLayouts.push_back(graphicsPipeline->descriptorSetLayouts[i]);
-    ++i;
-  }
+  PROFILE_SCOPE("GraphicsPipeline::Builder::Build");
 
   // --------------------------------------------------------------------------
   // PipelineLayout
   // --------------------------------------------------------------------------
-  auto info = vkiPipelineLayoutCreateInfo(
-    static_cast<uint32_t>(SharedLayouts.size()),
-    SharedLayouts.data(),
-    static_cast<uint32_t>(PushConstantRanges.size()),
-    PushConstantRanges.data());
+  std::shared_ptr<PipelineLayout> layout =
+    buildPipelineLayout(Device,
+                        ObjectCache,
+                        SharedLayouts,
+                        DescriptorSetLayouts,
+                        PushConstantRanges);
+
+  std::string key;
+  if (ObjectCache) {
+    key = GetKey(layout->handle);
+    auto cached = ObjectCache->FindPipeline(key);
+    if (cached)
+      return cached;
+  }
 
-  vkCreatePipelineLayout(
-    Device, &info, nullptr, &graphicsPipeline->pipelineLayout);
+  std::shared_ptr<GraphicsPipeline> graphicsPipeline(new GraphicsPipeline);
+  graphicsPipeline->device = Device;
+  graphicsPipeline->layout = layout;
+  graphicsPipeline->pipelineLayout = layout->handle;
+  for (const auto& setLayout : layout->ownedSetLayouts) {
+    graphicsPipeline->descriptorSetLayouts.push_back(setLayout->handle);
+  }
 
   // --------------------------------------------------------------------------
   // Pipeline
@@ -76,10 +131,14 @@ GraphicsPipeline::Builder::Build()
   PipelineColorBlendStateCreateInfo.blendConstants[2] = BlendConstants[2];
   PipelineColorBlendStateCreateInfo.blendConstants[3] = BlendConstants[3];
 
+  // Dynamic viewports and scissors still need a count, one unless given.
+  uint32_t viewportCount =
+    std::max(static_cast<uint32_t>(Viewports.size()), 1u);
+  uint32_t scissorCount = std::max(static_cast<uint32_t>(Scissors.size()), 1u);
+
   graphicsPipeline->pipeline = vkuCreateGraphicsPipeline(
     Device,
-    std::initializer_list<VkPipelineShaderStageCreateInfo>(
-      shaderStages.begin()._Ptr, shaderStages.end()._Ptr),
+    shaderStages,
     vkiPipelineVertexInputStateCreateInfo(
       static_cast<uint32_t>(VertexBindings.size()),
       VertexBindings.data(),
@@ -88,10 +147,12 @@ GraphicsPipeline::Builder::Build()
     vkiPipelineInputAssemblyStateCreateInfo(PrimitiveTopology,
                                             PrimitiveRestartEnable),
     vkiPipelineTessellationStateCreateInfo(PatchControlPoints),
-    vkiPipelineViewportStateCreateInfo(static_cast<uint32_t>(Viewports.size()),
-                                       Viewports.data(),
-                                       static_cast<uint32_t>(Scissors.size()),
-                                       Scissors.data()),
+    vkiPipelineViewportStateCreateInfo(viewportCount,
+                                       Viewports.empty() ? nullptr
+                                                         : Viewports.data(),
+                                       scissorCount,
+                                       Scissors.empty() ? nullptr
+                                                        : Scissors.data()),
     vkiPipelineRasterizationStateCreateInfo(DepthClampEnable,
                                             RasterizerDiscardEnable,
                                             PolygonMode,
@@ -125,9 +186,22 @@ GraphicsPipeline::Builder::Build()
     RenderPass,
     Subpass,
     VK_NULL_HANDLE,
-    -1);
+    -1,
+    PipelineCache);
 
-  graphicsPipeline->device = Device;
+  if (ObjectCache)
+    return ObjectCache->InsertPipeline(key, graphicsPipeline);
 
   return graphicsPipeline;
 }
+
+GraphicsPipeline::Pending
+GraphicsPipeline::Builder::BuildAsync(ThreadPool& pool) const
+{
+  Builder builder = *this;
+
+  Pending pending;
+  pending.future = pool.Submit([builder]() mutable { return builder.Build(); })
+                     .share();
+  return pending;
+}
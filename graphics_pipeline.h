@@ -1,22 +1,53 @@
 #pragma once
 
+#include <future>
+#include <memory>
+#include <string>
 #include <vector>
-#include <vulkan\vulkan_core.h>
+#include <vulkan/vulkan_core.h>
 
+#include "pipeline_object_cache.h"
+#include "thread_pool.h"
 #include "vk_init.h"
 #include "vk_utils.h"
 
+// Pipeline compiling on a worker thread, see the builders' BuildAsync.
+template<typename Pipeline>
+struct PendingPipeline
+{
+  std::shared_future<std::shared_ptr<Pipeline>> future;
+
+  bool IsValid() const { return future.valid(); }
+  bool IsReady() const
+  {
+    return future.valid() && future.wait_for(std::chrono::seconds(0)) ==
+                               std::future_status::ready;
+  }
+  // Returns the compiled pipeline, or fallback while it is still compiling.
+  // Never blocks, use it in the render loop.
+  std::shared_ptr<Pipeline> Get(const std::shared_ptr<Pipeline>& fallback) const
+  {
+    return IsReady() ? future.get() : fallback;
+  }
+  std::shared_ptr<Pipeline> Wait() const { return future.get(); }
+};
+
 struct GraphicsPipeline
 {
   VkDevice device = VK_NULL_HANDLE;
+  // Layouts created from Builder::DescriptorSetLayouts, in order.
   std::vector<VkDescriptorSetLayout> descriptorSetLayouts = {};
   VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
   VkPipeline pipeline = VK_NULL_HANDLE;
 
+  std::shared_ptr<PipelineLayout> layout = nullptr;
+
   struct Builder;
   friend struct Builder;
   static Builder GetBuilder();
 
+  typedef PendingPipeline<GraphicsPipeline> Pending;
+
   GraphicsPipeline& operator=(const GraphicsPipeline&) = delete;
   GraphicsPipeline(const GraphicsPipeline&) = delete;
 
@@ -71,11 +102,16 @@ struct GraphicsPipeline::Builder
   VkLogicOp LogicOp = VK_LOGIC_OP_CLEAR;
   std::vector<VkPipelineColorBlendAttachmentState> ColorBlendAttachments{};
   float BlendConstants[4] = { 0.f, 0.f, 0.f, 0.f };
-  std::vector<VkDynamicState> DynamicStates = {};
+  // Viewport and scissor are dynamic by default, a pipeline then survives
+  // swapchain resizes. Leave Viewports and Scissors empty in that case.
+  std::vector<VkDynamicState> DynamicStates = { VK_DYNAMIC_STATE_VIEWPORT,
+                                                VK_DYNAMIC_STATE_SCISSOR };
   VkRenderPass RenderPass = VK_NULL_HANDLE;
   uint32_t Subpass = 0;
   VkPipeline BasePipelineHandle = VK_NULL_HANDLE;
   int32_t BasePipelineIndex = -1;
+  VkPipelineCache PipelineCache = VK_NULL_HANDLE;
+  PipelineObjectCache* ObjectCache = nullptr;
 
   // clang-format off
 #define SETTER(type, ident)            \
@@ -131,6 +167,8 @@ struct GraphicsPipeline::Builder
 		SETTER(uint32_t, Subpass)
 		SETTER(VkPipeline, BasePipelineHandle)
 		SETTER(int32_t, BasePipelineIndex)
+		SETTER(VkPipelineCache, PipelineCache)
+		SETTER(PipelineObjectCache*, ObjectCache)
 
 #undef SETTER
   // clang-format on
@@ -144,5 +182,14 @@ struct GraphicsPipeline::Builder
     return *this;
   }
 
-  GraphicsPipeline* Builder::Build();
+  std::shared_ptr<GraphicsPipeline> Build();
+  // Compiles a copy of this builder's state on the pool. Builds of many
+  // builders run in parallel; the driver's pipeline cache and the object
+  // cache are safe to share between them.
+  Pending BuildAsync(ThreadPool& pool) const;
+
+private:
+  // Serialized pipeline state, everything except the layout objects which
+  // are represented by pipelineLayout.
+  std::string GetKey(VkPipelineLayout pipelineLayout) const;
 };
@@ -1,5 +1,7 @@
 #include "input.h"
 
+#include <cstring>
+
 void
 Input::Update(Window* window)
 {
@@ -1,19 +1,98 @@
 // clang-format off
-#include <vulkan\vulkan_core.h>
-#include <GLFW\glfw3.h>
+#include <vulkan/vulkan_core.h>
+#include <GLFW/glfw3.h>
 // clang-format on
 
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
 #include "window.h"
 #include "renderer.h"
 
 #include "input.h"
 #include "camera.h"
 #include "clock.h"
+#include "cpu_profiler.h"
+
+//   two_triangles [--headless] [--frames N] [--out image.ppm]
+//                 [--trace trace.json]
+//
+// --frames needs N >= 1, the last frame drawn is the one written to --out.
+struct Options
+{
+  bool headless = false;
+  // Headless only, the window renders until it is closed.
+  uint32_t frames = 100;
+  const char* out = "headless.ppm";
+  // Chrome trace of the CPU profiler, written on exit.
+  const char* trace = nullptr;
+};
+
+bool
+parseOptions(int argc, char** argv, Options& options)
+{
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
 
+    if (strcmp(arg, "--headless") == 0) {
+      options.headless = true;
+    } else if (strcmp(arg, "--frames") == 0 && value) {
+      options.frames = atoi(argv[++i]);
+    } else if (strcmp(arg, "--out") == 0 && value) {
+      options.out = argv[++i];
+    } else if (strcmp(arg, "--trace") == 0 && value) {
+      options.trace = argv[++i];
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return false;
+    }
+  }
+
+  if (options.frames == 0) {
+    fprintf(stderr, "--frames must be at least 1\n");
+    return false;
+  }
+  return true;
+}
+
+// Renders the frames without a window and writes the last one as a binary
+// PPM.
 int
-main()
+runHeadless(const Options& options)
 {
+  Renderer renderer(nullptr);
+  VkExtent2D extent = renderer.swapchain->imageExtent;
+  Camera cam(70.f, float(extent.width) / extent.height, 0.1f, 1000.f);
+  cam.SetPosition({ 0.0f, 0.0f, 5.0f });
+
+  for (uint32_t i = 0; i < options.frames; ++i) {
+    PROFILE_SCOPE("Frame");
+    renderer.drawFrame(cam.GetProjView());
+  }
+
+  std::vector<uint8_t> pixels =
+    renderer.ReadbackImage(renderer.presentedImageIdx);
 
+  FILE* file = fopen(options.out, "wb");
+  if (!file)
+    return 1;
+
+  fprintf(file, "P6\n%u %u\n255\n", extent.width, extent.height);
+  for (size_t i = 0; i < pixels.size(); i += 4) {
+    // BGRA to RGB
+    uint8_t rgb[3] = { pixels[i + 2], pixels[i + 1], pixels[i] };
+    fwrite(rgb, 1, 3, file);
+  }
+  fclose(file);
+
+  return 0;
+}
+
+int
+runWindowed()
+{
   Window window(1280, 920, "Two Triangles");
   Renderer renderer(&window);
   Camera cam(70.f, 1280.f / 920.f, 0.1f, 1000.f);
@@ -21,15 +100,54 @@ main()
   Input input = {};
   Clock clock = {};
 
-  while (true) {
-    window.Update();
-    input.Update(&window);
-    renderer.Update();
-    clock.Update();
-    cam.Update(&input, &clock);
+  while (!glfwWindowShouldClose(window.glfwWindow)) {
+    PROFILE_SCOPE("Frame");
+    {
+      PROFILE_SCOPE("Window::Update");
+      window.Update();
+    }
+    {
+      PROFILE_SCOPE("Input::Update");
+      input.Update(&window);
+    }
+    {
+      PROFILE_SCOPE("Renderer::Update");
+      renderer.Update();
+    }
+    {
+      PROFILE_SCOPE("Clock::Update");
+      clock.Update();
+    }
+    {
+      PROFILE_SCOPE("Camera::Update");
+      cam.Update(&input, &clock);
+    }
 
     renderer.drawFrame(cam.GetProjView());
   }
 
   return 0;
 }
+
+int
+main(int argc, char** argv)
+{
+  Options options;
+  if (!parseOptions(argc, argv, options))
+    return 1;
+
+  if (options.trace) {
+    CpuProfiler::SetThreadName("Main");
+    CpuProfiler::Enable(true);
+  }
+
+  int result = options.headless ? runHeadless(options) : runWindowed();
+
+  // The renderer is gone, its worker threads are joined.
+  if (options.trace && !CpuProfiler::WriteTrace(options.trace)) {
+    fprintf(stderr, "cannot write %s\n", options.trace);
+    return 1;
+  }
+
+  return result;
+}
@@ -0,0 +1,344 @@
+#include "memory_allocator.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "vk_init.h"
+#include "vk_utils.h"
+
+static VkDeviceSize
+alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+MemoryAllocator::MemoryAllocator(
+  VkDevice device,
+  const VkPhysicalDeviceProperties& props,
+  const VkPhysicalDeviceMemoryProperties& memProps,
+  VkDeviceSize blockSize)
+  : device(device)
+  , memProps(memProps)
+  , nonCoherentAtomSize(props.limits.nonCoherentAtomSize)
+  , maxMemoryAllocationCount(props.limits.maxMemoryAllocationCount)
+  , blockSize(blockSize)
+{}
+
+MemoryAllocator::~MemoryAllocator()
+{
+  for (auto& pool : pools) {
+    for (auto& blocks : pool) {
+      for (auto block : blocks) {
+        DestroyBlock(block);
+      }
+      blocks.clear();
+    }
+  }
+}
+
+MemoryAllocator::Allocation
+MemoryAllocator::Allocate(const VkMemoryRequirements& memoryRequirements,
+                          VkMemoryPropertyFlags propertyFlags,
+                          bool linear)
+{
+  Allocation allocation = {};
+
+  uint32_t memoryTypeIdx =
+    findMemoryTypeIdx(memoryRequirements, memProps, propertyFlags);
+  if (memoryTypeIdx == (uint32_t)-1)
+    return allocation;
+
+  // Keep host-visible, non-coherent allocations atom aligned so flushing one
+  // allocation never touches its neighbours.
+  VkDeviceSize alignment = memoryRequirements.alignment;
+  VkMemoryPropertyFlags typeFlags =
+    memProps.memoryTypes[memoryTypeIdx].propertyFlags;
+  if ((typeFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+      !(typeFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+    alignment = std::max(alignment, nonCoherentAtomSize);
+  }
+  VkDeviceSize size = alignUp(memoryRequirements.size, alignment);
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  // Large resources get a block of their own, they would only fragment the
+  // shared blocks.
+  if (size > blockSize / 2) {
+    Block* block = CreateBlock(memoryTypeIdx, size, linear);
+    if (!block)
+      return allocation;
+    block->dedicated = true;
+    AllocateFromBlock(block, size, alignment, allocation);
+    pools[memoryTypeIdx][linear].push_back(block);
+    return allocation;
+  }
+
+  auto& blocks = pools[memoryTypeIdx][linear];
+  for (auto block : blocks) {
+    if (!block->dedicated &&
+        AllocateFromBlock(block, size, alignment, allocation)) {
+      return allocation;
+    }
+  }
+
+  Block* block = CreateBlock(memoryTypeIdx, blockSize, linear);
+  if (!block)
+    return allocation;
+  blocks.push_back(block);
+  AllocateFromBlock(block, size, alignment, allocation);
+  return allocation;
+}
+
+void
+MemoryAllocator::Free(const Allocation& allocation)
+{
+  if (!allocation.IsValid())
+    return;
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  Block* block = allocation.block;
+  block->allocationCount -= 1;
+  block->usedBytes -= allocation.size;
+
+  auto& freeRanges = block->freeRanges;
+  VkDeviceSize offset = allocation.offset;
+  VkDeviceSize size = allocation.size;
+
+  auto next = freeRanges.lower_bound(offset);
+  if (next != freeRanges.end() && offset + size == next->first) {
+    size += next->second;
+    next = freeRanges.erase(next);
+  }
+  if (next != freeRanges.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      offset = prev->first;
+      size += prev->second;
+      freeRanges.erase(prev);
+    }
+  }
+  freeRanges[offset] = size;
+
+  if (block->allocationCount > 0)
+    return;
+
+  // Keep one empty shared block per pool around, allocation patterns tend to
+  // repeat and recreating it would be a vkAllocateMemory per frame.
+  auto& blocks = pools[block->memoryTypeIdx][block->linear];
+  if (!block->dedicated) {
+    auto emptyBlocks = std::count_if(
+      blocks.begin(), blocks.end(), [](const Block* b) {
+        return !b->dedicated && b->allocationCount == 0;
+      });
+    if (emptyBlocks <= 1)
+      return;
+  }
+
+  blocks.erase(std::find(blocks.begin(), blocks.end(), block));
+  DestroyBlock(block);
+}
+
+MemoryAllocator::Allocation
+MemoryAllocator::AllocateForBuffer(VkBuffer buffer,
+                                   VkMemoryPropertyFlags propertyFlags,
+                                   bool bind)
+{
+  VkMemoryRequirements memoryRequirements;
+  vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
+
+  Allocation allocation = Allocate(memoryRequirements, propertyFlags, true);
+
+  if (bind && allocation.IsValid()) {
+    ASSERT_VK_SUCCESS(vkBindBufferMemory(
+      device, buffer, allocation.memory, allocation.offset));
+  }
+
+  return allocation;
+}
+
+MemoryAllocator::Allocation
+MemoryAllocator::AllocateForImage(VkImage image,
+                                  VkMemoryPropertyFlags propertyFlags,
+                                  VkImageTiling tiling,
+                                  bool bind)
+{
+  VkMemoryRequirements memoryRequirements;
+  vkGetImageMemoryRequirements(device, image, &memoryRequirements);
+
+  Allocation allocation = Allocate(
+    memoryRequirements, propertyFlags, tiling == VK_IMAGE_TILING_LINEAR);
+
+  if (bind && allocation.IsValid()) {
+    ASSERT_VK_SUCCESS(vkBindImageMemory(
+      device, image, allocation.memory, allocation.offset));
+  }
+
+  return allocation;
+}
+
+bool
+MemoryAllocator::IsHostCoherent(const Allocation& allocation) const
+{
+  return (memProps.memoryTypes[allocation.memoryTypeIdx].propertyFlags &
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+}
+
+bool
+MemoryAllocator::IsUnifiedMemory() const
+{
+  for (uint32_t i = 0; i < memProps.memoryHeapCount; ++i) {
+    if (!(memProps.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+      return false;
+  }
+  return memProps.memoryHeapCount > 0;
+}
+
+VkMappedMemoryRange
+MemoryAllocator::GetMappedRange(const Allocation& allocation,
+                                VkDeviceSize offset,
+                                VkDeviceSize size) const
+{
+  if (size == VK_WHOLE_SIZE) {
+    size = allocation.size - offset;
+  }
+
+  // Allocations of non-coherent types are atom aligned in offset and size,
+  // widening the range to atom boundaries stays inside the allocation.
+  VkDeviceSize begin = offset / nonCoherentAtomSize * nonCoherentAtomSize;
+  VkDeviceSize end = std::min(alignUp(offset + size, nonCoherentAtomSize),
+                              allocation.size);
+
+  return vkiMappedMemoryRange(
+    allocation.memory, allocation.offset + begin, end - begin);
+}
+
+void
+MemoryAllocator::Flush(const Allocation& allocation,
+                       VkDeviceSize offset,
+                       VkDeviceSize size)
+{
+  if (IsHostCoherent(allocation))
+    return;
+
+  auto range = GetMappedRange(allocation, offset, size);
+  ASSERT_VK_SUCCESS(vkFlushMappedMemoryRanges(device, 1, &range));
+}
+
+void
+MemoryAllocator::Invalidate(const Allocation& allocation,
+                            VkDeviceSize offset,
+                            VkDeviceSize size)
+{
+  if (IsHostCoherent(allocation))
+    return;
+
+  auto range = GetMappedRange(allocation, offset, size);
+  ASSERT_VK_SUCCESS(vkInvalidateMappedMemoryRanges(device, 1, &range));
+}
+
+MemoryAllocator::Stats
+MemoryAllocator::GetStats()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  Stats stats = {};
+  for (uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; ++type) {
+    for (auto& blocks : pools[type]) {
+      for (auto block : blocks) {
+        stats.types[type].blockCount += 1;
+        stats.types[type].allocationCount += block->allocationCount;
+        stats.types[type].reservedBytes += block->size;
+        stats.types[type].usedBytes += block->usedBytes;
+      }
+    }
+    stats.total.blockCount += stats.types[type].blockCount;
+    stats.total.allocationCount += stats.types[type].allocationCount;
+    stats.total.reservedBytes += stats.types[type].reservedBytes;
+    stats.total.usedBytes += stats.types[type].usedBytes;
+  }
+  return stats;
+}
+
+MemoryAllocator::Block*
+MemoryAllocator::CreateBlock(uint32_t memoryTypeIdx,
+                             VkDeviceSize size,
+                             bool linear)
+{
+  if (deviceAllocationCount >= maxMemoryAllocationCount)
+    return nullptr;
+
+  VkDeviceMemory memory = vkuAllocateMemory(device, size, memoryTypeIdx);
+  if (memory == VK_NULL_HANDLE)
+    return nullptr;
+
+  Block* block = new Block;
+  block->memory = memory;
+  block->size = size;
+  block->memoryTypeIdx = memoryTypeIdx;
+  block->linear = linear;
+  block->freeRanges[0] = size;
+
+  if (memProps.memoryTypes[memoryTypeIdx].propertyFlags &
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    void* data = nullptr;
+    ASSERT_VK_SUCCESS(
+      vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &data));
+    block->mapped = static_cast<uint8_t*>(data);
+  }
+
+  ++deviceAllocationCount;
+  return block;
+}
+
+void
+MemoryAllocator::DestroyBlock(Block* block)
+{
+  if (block->mapped) {
+    vkUnmapMemory(device, block->memory);
+  }
+  vkFreeMemory(device, block->memory, nullptr);
+  --deviceAllocationCount;
+  delete block;
+}
+
+bool
+MemoryAllocator::AllocateFromBlock(Block* block,
+                                   VkDeviceSize size,
+                                   VkDeviceSize alignment,
+                                   Allocation& allocation)
+{
+  auto& freeRanges = block->freeRanges;
+
+  for (auto it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+    VkDeviceSize rangeOffset = it->first;
+    VkDeviceSize rangeSize = it->second;
+    VkDeviceSize offset = alignUp(rangeOffset, alignment);
+
+    if (offset + size > rangeOffset + rangeSize)
+      continue;
+
+    freeRanges.erase(it);
+    if (offset > rangeOffset) {
+      freeRanges[rangeOffset] = offset - rangeOffset;
+    }
+    if (offset + size < rangeOffset + rangeSize) {
+      freeRanges[offset + size] = rangeOffset + rangeSize - offset - size;
+    }
+
+    // The alignment padding stays in the free list, the allocation covers
+    // exactly [offset, offset + size).
+    block->allocationCount += 1;
+    block->usedBytes += size;
+
+    allocation.memory = block->memory;
+    allocation.offset = offset;
+    allocation.size = size;
+    allocation.mapped = block->mapped ? block->mapped + offset : nullptr;
+    allocation.memoryTypeIdx = block->memoryTypeIdx;
+    allocation.block = block;
+    return true;
+  }
+
+  return false;
+}
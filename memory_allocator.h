@@ -0,0 +1,119 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Sub-allocates buffers and images from large VkDeviceMemory blocks instead
+// of calling vkAllocateMemory per resource. Every memory type has two pools,
+// one for linear resources (buffers) and one for optimally tiled images, so
+// neighbouring resources never violate bufferImageGranularity. Blocks keep a
+// free list ordered by offset, allocation is first fit and freeing coalesces
+// adjacent ranges. Host-visible blocks are mapped once when created.
+struct MemoryAllocator
+{
+  struct Block;
+
+  struct Allocation
+  {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    // Points at offset inside the block mapping for host-visible memory.
+    void* mapped = nullptr;
+    uint32_t memoryTypeIdx = (uint32_t)-1;
+    Block* block = nullptr;
+
+    bool IsValid() const { return memory != VK_NULL_HANDLE; }
+  };
+
+  struct Block
+  {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    uint8_t* mapped = nullptr;
+    uint32_t memoryTypeIdx = (uint32_t)-1;
+    bool linear = true;
+    bool dedicated = false;
+    uint32_t allocationCount = 0;
+    VkDeviceSize usedBytes = 0;
+    std::map<VkDeviceSize, VkDeviceSize> freeRanges = {}; // offset -> size
+  };
+
+  struct Stats
+  {
+    struct Type
+    {
+      uint32_t blockCount = 0;
+      uint32_t allocationCount = 0;
+      VkDeviceSize reservedBytes = 0;
+      VkDeviceSize usedBytes = 0;
+    };
+
+    Type types[VK_MAX_MEMORY_TYPES] = {};
+    Type total = {};
+  };
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memProps = {};
+  VkDeviceSize nonCoherentAtomSize = 1;
+  uint32_t maxMemoryAllocationCount = 0;
+  VkDeviceSize blockSize = 0;
+
+  MemoryAllocator(VkDevice device,
+                  const VkPhysicalDeviceProperties& props,
+                  const VkPhysicalDeviceMemoryProperties& memProps,
+                  VkDeviceSize blockSize = 64 * 1024 * 1024);
+
+  MemoryAllocator(const MemoryAllocator&) = delete;
+  MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+  ~MemoryAllocator();
+
+  // Returns an invalid allocation if no memory type matches propertyFlags or
+  // the device is out of memory.
+  Allocation Allocate(const VkMemoryRequirements& memoryRequirements,
+                      VkMemoryPropertyFlags propertyFlags,
+                      bool linear);
+  void Free(const Allocation& allocation);
+
+  Allocation AllocateForBuffer(VkBuffer buffer,
+                               VkMemoryPropertyFlags propertyFlags,
+                               bool bind = true);
+  Allocation AllocateForImage(VkImage image,
+                              VkMemoryPropertyFlags propertyFlags,
+                              VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL,
+                              bool bind = true);
+
+  bool IsHostCoherent(const Allocation& allocation) const;
+  // True if every heap is device-local, as on integrated GPUs sharing system
+  // memory. Host-visible memory is then as fast for the device as any other.
+  bool IsUnifiedMemory() const;
+  // Flushes host writes to a mapped allocation, does nothing on coherent
+  // memory. offset is relative to the allocation.
+  void Flush(const Allocation& allocation,
+             VkDeviceSize offset = 0,
+             VkDeviceSize size = VK_WHOLE_SIZE);
+  // Makes device writes visible to the host, the counterpart of Flush.
+  void Invalidate(const Allocation& allocation,
+                  VkDeviceSize offset = 0,
+                  VkDeviceSize size = VK_WHOLE_SIZE);
+
+  Stats GetStats();
+
+private:
+  std::mutex mutex;
+  std::vector<Block*> pools[VK_MAX_MEMORY_TYPES][2];
+  uint32_t deviceAllocationCount = 0;
+
+  Block* CreateBlock(uint32_t memoryTypeIdx, VkDeviceSize size, bool linear);
+  void DestroyBlock(Block* block);
+  bool AllocateFromBlock(Block* block,
+                         VkDeviceSize size,
+                         VkDeviceSize alignment,
+                         Allocation& allocation);
+  VkMappedMemoryRange GetMappedRange(const Allocation& allocation,
+                                     VkDeviceSize offset,
+                                     VkDeviceSize size) const;
+};
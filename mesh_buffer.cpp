@@ -0,0 +1,72 @@
+#include "mesh_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "vk_utils.h"
+
+MeshBuffer::MeshBuffer(VkDevice device,
+                       MemoryAllocator* allocator,
+                       UploadManager* uploader,
+                       VkBufferUsageFlags usage,
+                       VkDeviceSize size,
+                       const void* data,
+                       const std::vector<uint32_t>& otherQueueFamilies)
+  : device(device)
+  , allocator(allocator)
+  , uploader(uploader)
+  , size(size)
+{
+  // The upload family writes a shared buffer too.
+  std::vector<uint32_t> queueFamilies;
+  if (!otherQueueFamilies.empty()) {
+    queueFamilies = { uploader->dstQueueFamilyIdx, uploader->queueFamilyIdx };
+    queueFamilies.insert(queueFamilies.end(),
+                         otherQueueFamilies.begin(),
+                         otherQueueFamilies.end());
+    std::sort(queueFamilies.begin(), queueFamilies.end());
+    queueFamilies.erase(
+      std::unique(queueFamilies.begin(), queueFamilies.end()),
+      queueFamilies.end());
+  }
+  bool concurrent = queueFamilies.size() > 1;
+
+  // TRANSFER_DST either way, unified memory may still need the staged path.
+  buffer = vkuCreateBuffer(device,
+                           size,
+                           usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                           concurrent ? VK_SHARING_MODE_CONCURRENT
+                                      : VK_SHARING_MODE_EXCLUSIVE,
+                           queueFamilies);
+  ASSERT_VK_VALID_HANDLE(buffer);
+
+  if (allocator->IsUnifiedMemory()) {
+    // Fails if no device-local type is host-visible, then stage anyway.
+    allocation = allocator->AllocateForBuffer(
+      buffer,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+  }
+
+  if (allocation.IsValid()) {
+    memcpy(allocation.mapped, data, size);
+    allocator->Flush(allocation);
+    return;
+  }
+
+  allocation =
+    allocator->AllocateForBuffer(buffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  ASSERT_TRUE(allocation.IsValid());
+  uploader->UploadBuffer(buffer, 0, size, data, concurrent);
+  staged = true;
+}
+
+MeshBuffer::~MeshBuffer()
+{
+  if (staged && uploader->HasPendingCopies()) {
+    uploader->Flush();
+  }
+
+  vkDestroyBuffer(device, buffer, nullptr);
+  allocator->Free(allocation);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "memory_allocator.h"
+#include "upload_manager.h"
+
+// Buffer of static geometry, written once at creation. It lives in
+// device-local memory and is filled through the upload manager; the copy is
+// part of the next submitted batch, whose closing barrier orders it before
+// later frames. On unified memory devices the data is written in place to
+// device-local, host-visible memory instead, a staged copy would only cost
+// bandwidth there.
+struct MeshBuffer
+{
+  VkDevice device = VK_NULL_HANDLE;
+  MemoryAllocator* allocator = nullptr;
+  UploadManager* uploader = nullptr;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  MemoryAllocator::Allocation allocation = {};
+  VkDeviceSize size = 0;
+  // False if the data was written through a mapping.
+  bool staged = false;
+
+  // Queue families other than the uploader's destination family that use
+  // the buffer, e.g. an async compute family. The buffer is then shared
+  // concurrently instead of being owned by one family.
+  MeshBuffer(VkDevice device,
+             MemoryAllocator* allocator,
+             UploadManager* uploader,
+             VkBufferUsageFlags usage,
+             VkDeviceSize size,
+             const void* data,
+             const std::vector<uint32_t>& otherQueueFamilies = {});
+
+  MeshBuffer(const MeshBuffer&) = delete;
+  MeshBuffer& operator=(const MeshBuffer&) = delete;
+
+  // The buffer must no longer be in use. A copy still waiting in the
+  // uploader's open batch is flushed first, it would run on a destroyed
+  // buffer otherwise.
+  ~MeshBuffer();
+};
@@ -0,0 +1,268 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "vk_utils.h"
+
+const uint32_t MeshOptimizer::kSimulatedCacheSize;
+
+// FNV-1a over the vertex bytes.
+static uint32_t
+hashVertex(const uint8_t* vertex, size_t stride)
+{
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < stride; ++i) {
+    hash = (hash ^ vertex[i]) * 16777619u;
+  }
+  return hash;
+}
+
+uint32_t
+MeshOptimizer::Deduplicate(const void* vertices,
+                           size_t count,
+                           size_t stride,
+                           void* uniqueVertices,
+                           uint32_t* indices)
+{
+  const uint8_t* src = static_cast<const uint8_t*>(vertices);
+  uint8_t* dst = static_cast<uint8_t*>(uniqueVertices);
+
+  // Open addressing, at most half full. Slots hold unique vertex indices.
+  size_t tableSize = 1;
+  while (tableSize < 2 * count) {
+    tableSize *= 2;
+  }
+  std::vector<uint32_t> table(tableSize, (uint32_t)-1);
+
+  uint32_t uniqueCount = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const uint8_t* vertex = src + i * stride;
+    size_t slot = hashVertex(vertex, stride) & (tableSize - 1);
+
+    while (table[slot] != (uint32_t)-1 &&
+           memcmp(dst + table[slot] * stride, vertex, stride) != 0) {
+      slot = (slot + 1) & (tableSize - 1);
+    }
+
+    if (table[slot] == (uint32_t)-1) {
+      memcpy(dst + uniqueCount * stride, vertex, stride);
+      table[slot] = uniqueCount++;
+    }
+    indices[i] = table[slot];
+  }
+
+  return uniqueCount;
+}
+
+// Forsyth's scoring, tuned for the cache size below.
+static const int kCacheSize = 32;
+
+static float
+vertexScore(int cachePosition, uint32_t remainingTriangles)
+{
+  if (remainingTriangles == 0)
+    return -1.0f;
+
+  float score = 0.0f;
+  if (cachePosition >= 0) {
+    // The last triangle's vertices score the same, whichever of them is
+    // used next, a triangle sharing an edge with it follows.
+    if (cachePosition < 3) {
+      score = 0.75f;
+    } else {
+      float scale = 1.0f / (kCacheSize - 3);
+      score = powf(1.0f - (cachePosition - 3) * scale, 1.5f);
+    }
+  }
+
+  // Prefer finishing vertices with few triangles left, so they can leave the
+  // cache for good.
+  score += 2.0f / sqrtf(static_cast<float>(remainingTriangles));
+  return score;
+}
+
+void
+MeshOptimizer::OptimizeVertexCache(uint32_t* indices,
+                                   size_t indexCount,
+                                   size_t vertexCount)
+{
+  size_t triangleCount = indexCount / 3;
+  if (triangleCount == 0)
+    return;
+
+  // Triangles adjacent to every vertex, vertex v owns the range starting at
+  // adjacencyOffsets[v] with remaining[v] triangles not emitted yet.
+  std::vector<uint32_t> remaining(vertexCount, 0);
+  for (size_t i = 0; i < indexCount; ++i) {
+    ASSERT_TRUE(indices[i] < vertexCount);
+    ++remaining[indices[i]];
+  }
+
+  std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    adjacencyOffsets[v + 1] = adjacencyOffsets[v] + remaining[v];
+  }
+
+  std::vector<uint32_t> adjacency(indexCount);
+  std::vector<uint32_t> fill(adjacencyOffsets.begin(),
+                             adjacencyOffsets.end() - 1);
+  for (size_t t = 0; t < triangleCount; ++t) {
+    for (size_t k = 0; k < 3; ++k) {
+      adjacency[fill[indices[3 * t + k]]++] = static_cast<uint32_t>(t);
+    }
+  }
+
+  std::vector<float> vertexScores(vertexCount);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    vertexScores[v] = vertexScore(-1, remaining[v]);
+  }
+
+  std::vector<float> triangleScores(triangleCount);
+  for (size_t t = 0; t < triangleCount; ++t) {
+    triangleScores[t] = vertexScores[indices[3 * t]] +
+                        vertexScores[indices[3 * t + 1]] +
+                        vertexScores[indices[3 * t + 2]];
+  }
+
+  std::vector<bool> emitted(triangleCount, false);
+  std::vector<uint32_t> output;
+  output.reserve(indexCount);
+
+  // Three slots extra for the vertices pushed in before the cache is cut.
+  std::vector<uint32_t> cache;
+  std::vector<uint32_t> newCache;
+  cache.reserve(kCacheSize + 3);
+  newCache.reserve(kCacheSize + 3);
+
+  size_t bestTriangle = 0;
+  size_t nextUnemitted = 0;
+
+  for (size_t emittedCount = 0; emittedCount < triangleCount;
+       ++emittedCount) {
+    // Nothing in the cache is adjacent to a free triangle, pick any.
+    if (bestTriangle == (size_t)-1) {
+      while (emitted[nextUnemitted]) {
+        ++nextUnemitted;
+      }
+      bestTriangle = nextUnemitted;
+    }
+
+    size_t t = bestTriangle;
+    const uint32_t* triangle = &indices[3 * t];
+    emitted[t] = true;
+
+    for (size_t k = 0; k < 3; ++k) {
+      uint32_t v = triangle[k];
+      output.push_back(v);
+
+      // Swap the triangle out of v's remaining range.
+      uint32_t* first = &adjacency[adjacencyOffsets[v]];
+      uint32_t* last = first + remaining[v] - 1;
+      *std::find(first, last + 1, static_cast<uint32_t>(t)) = *last;
+      --remaining[v];
+    }
+
+    // Most recently used first, the previous contents follow.
+    newCache.assign(triangle, triangle + 3);
+    for (uint32_t v : cache) {
+      if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+        newCache.push_back(v);
+      }
+    }
+
+    // Evicted vertices lose their cache bonus.
+    for (size_t i = kCacheSize; i < newCache.size(); ++i) {
+      uint32_t v = newCache[i];
+      float score = vertexScore(-1, remaining[v]);
+      float delta = score - vertexScores[v];
+      vertexScores[v] = score;
+
+      const uint32_t* first = &adjacency[adjacencyOffsets[v]];
+      for (uint32_t j = 0; j < remaining[v]; ++j) {
+        triangleScores[first[j]] += delta;
+      }
+    }
+    newCache.resize(std::min<size_t>(newCache.size(), kCacheSize));
+    cache.swap(newCache);
+
+    // Rescore the cached vertices and pick the best triangle around them.
+    bestTriangle = (size_t)-1;
+    float bestScore = -1.0f;
+
+    for (size_t i = 0; i < cache.size(); ++i) {
+      uint32_t v = cache[i];
+      float score = vertexScore(static_cast<int>(i), remaining[v]);
+      float delta = score - vertexScores[v];
+      vertexScores[v] = score;
+
+      const uint32_t* first = &adjacency[adjacencyOffsets[v]];
+      for (uint32_t j = 0; j < remaining[v]; ++j) {
+        uint32_t adjacent = first[j];
+        triangleScores[adjacent] += delta;
+        if (triangleScores[adjacent] > bestScore) {
+          bestScore = triangleScores[adjacent];
+          bestTriangle = adjacent;
+        }
+      }
+    }
+  }
+
+  std::copy(output.begin(), output.end(), indices);
+}
+
+uint32_t
+MeshOptimizer::OptimizeVertexFetch(void* vertices,
+                                   size_t vertexCount,
+                                   size_t stride,
+                                   uint32_t* indices,
+                                   size_t indexCount)
+{
+  std::vector<uint32_t> remap(vertexCount, (uint32_t)-1);
+  uint32_t nextVertex = 0;
+
+  for (size_t i = 0; i < indexCount; ++i) {
+    uint32_t& target = remap[indices[i]];
+    if (target == (uint32_t)-1) {
+      target = nextVertex++;
+    }
+    indices[i] = target;
+  }
+
+  uint8_t* data = static_cast<uint8_t*>(vertices);
+  std::vector<uint8_t> reordered(nextVertex * stride);
+  for (size_t v = 0; v < vertexCount; ++v) {
+    if (remap[v] != (uint32_t)-1) {
+      memcpy(&reordered[remap[v] * stride], data + v * stride, stride);
+    }
+  }
+  std::copy(reordered.begin(), reordered.end(), data);
+
+  return nextVertex;
+}
+
+float
+MeshOptimizer::CalculateACMR(const uint32_t* indices,
+                             size_t indexCount,
+                             size_t vertexCount,
+                             uint32_t cacheSize)
+{
+  if (indexCount < 3)
+    return 0.0f;
+
+  // A vertex is cached while fewer than cacheSize misses followed its own.
+  std::vector<uint32_t> insertedAt(vertexCount, 0);
+  uint32_t time = cacheSize + 1;
+  uint32_t misses = 0;
+
+  for (size_t i = 0; i < indexCount; ++i) {
+    uint32_t v = indices[i];
+    if (time - insertedAt[v] > cacheSize) {
+      insertedAt[v] = time++;
+      ++misses;
+    }
+  }
+
+  return float(misses) / (indexCount / 3);
+}
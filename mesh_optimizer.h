@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+// Import-time optimizations of triangle lists. Vertices are compared and
+// moved as raw bytes of stride size, so padding inside a vertex must be
+// zeroed for deduplication to find all duplicates.
+//
+// Optimize() runs the whole chain on a non-indexed mesh:
+//   1. Deduplicate() merges identical vertices and creates the index list.
+//   2. OptimizeVertexCache() reorders triangles so that vertices are reused
+//      while they are still in the post-transform cache (Forsyth, "Linear-
+//      Speed Vertex Cache Optimisation").
+//   3. OptimizeVertexFetch() orders vertices by first use, so fetching walks
+//      the vertex buffer mostly linearly.
+struct MeshOptimizer
+{
+  struct Stats
+  {
+    uint32_t vertexCountBefore = 0;
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+    // Average cache miss ratio, transformed vertices per triangle. 0.5 is
+    // the ideal for large regular meshes, 3 means no reuse at all. Measured
+    // on the input, after Deduplicate() and after the whole chain.
+    float acmrBefore = 0.0f;
+    float acmrDeduplicated = 0.0f;
+    float acmr = 0.0f;
+  };
+
+  // FIFO cache size used by CalculateACMR, smaller than most real caches to
+  // not overstate the gains.
+  static const uint32_t kSimulatedCacheSize = 16;
+
+  // Writes the unique vertices to uniqueVertices, which must hold count
+  // vertices, and one index per input vertex. Returns the unique count.
+  static uint32_t Deduplicate(const void* vertices,
+                              size_t count,
+                              size_t stride,
+                              void* uniqueVertices,
+                              uint32_t* indices);
+
+  // Reorders the triangles of an indexed triangle list in place.
+  static void OptimizeVertexCache(uint32_t* indices,
+                                  size_t indexCount,
+                                  size_t vertexCount);
+
+  // Orders vertices by first use and remaps the indices in place.
+  // Unreferenced vertices are dropped, returns the remaining count.
+  static uint32_t OptimizeVertexFetch(void* vertices,
+                                      size_t vertexCount,
+                                      size_t stride,
+                                      uint32_t* indices,
+                                      size_t indexCount);
+
+  // Simulated FIFO cache misses per triangle.
+  static float CalculateACMR(const uint32_t* indices,
+                             size_t indexCount,
+                             size_t vertexCount,
+                             uint32_t cacheSize = kSimulatedCacheSize);
+
+  // Turns a non-indexed triangle list into an optimized indexed one.
+  template<typename Vertex>
+  static Stats Optimize(std::vector<Vertex>& vertices,
+                        std::vector<uint32_t>& indices)
+  {
+    Stats stats;
+    size_t count = vertices.size();
+    stats.vertexCountBefore = static_cast<uint32_t>(count);
+    stats.indexCount = static_cast<uint32_t>(count);
+
+    // Drawn without indices, vertex i is the i-th one fetched.
+    indices.resize(count);
+    std::iota(indices.begin(), indices.end(), 0u);
+    stats.acmrBefore = CalculateACMR(indices.data(), count, count);
+
+    std::vector<Vertex> unique(count);
+    uint32_t uniqueCount = Deduplicate(
+      vertices.data(), count, sizeof(Vertex), unique.data(), indices.data());
+    stats.acmrDeduplicated = CalculateACMR(indices.data(), count, uniqueCount);
+
+    OptimizeVertexCache(indices.data(), count, uniqueCount);
+    uniqueCount = OptimizeVertexFetch(
+      unique.data(), uniqueCount, sizeof(Vertex), indices.data(), count);
+
+    unique.resize(uniqueCount);
+    vertices.swap(unique);
+
+    stats.vertexCount = uniqueCount;
+    stats.acmr = CalculateACMR(indices.data(), count, uniqueCount);
+    return stats;
+  }
+};
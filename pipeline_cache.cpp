@@ -0,0 +1,137 @@
+#include "pipeline_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "vk_init.h"
+#include "vk_utils.h"
+
+PipelineCache::PipelineCache(VkDevice device,
+                             const VkPhysicalDeviceProperties& props,
+                             const char* path)
+  : device(device)
+  , props(props)
+  , path(path)
+{
+  std::string data = Load();
+
+  auto info = vkiPipelineCacheCreateInfo(data.size(), data.data());
+  VkResult result = vkCreatePipelineCache(device, &info, nullptr, &handle);
+
+  // Drivers may still reject data that passed our checks, start empty then.
+  if (result != VK_SUCCESS) {
+    info = vkiPipelineCacheCreateInfo(0, nullptr);
+    ASSERT_VK_SUCCESS(vkCreatePipelineCache(device, &info, nullptr, &handle));
+  }
+}
+
+PipelineCache::~PipelineCache()
+{
+  Save();
+  vkDestroyPipelineCache(device, handle, nullptr);
+}
+
+bool
+PipelineCache::Save()
+{
+  size_t size = 0;
+  if (vkGetPipelineCacheData(device, handle, &size, nullptr) != VK_SUCCESS)
+    return false;
+
+  std::vector<uint8_t> data(size);
+  if (vkGetPipelineCacheData(device, handle, &size, data.data()) !=
+      VK_SUCCESS)
+    return false;
+
+  FileHeader header = {};
+  header.magic = kMagic;
+  header.version = kVersion;
+  header.vendorID = props.vendorID;
+  header.deviceID = props.deviceID;
+  header.driverVersion = props.driverVersion;
+  memcpy(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE);
+  header.dataSize = size;
+
+  // Write a temporary file first, a crash while saving must not leave a
+  // truncated cache behind.
+  std::string tmpPath = path + ".tmp";
+
+  FILE* file = fopen(tmpPath.c_str(), "wb");
+  if (!file)
+    return false;
+
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(data.data(), 1, size, file) == size;
+  ok = fclose(file) == 0 && ok;
+
+  if (!ok) {
+    remove(tmpPath.c_str());
+    return false;
+  }
+
+  remove(path.c_str());
+  return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+std::string
+PipelineCache::Load()
+{
+  std::string data;
+
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file)
+    return data;
+
+  FileHeader header = {};
+  if (fread(&header, sizeof(header), 1, file) == 1 &&
+      header.dataSize < (1ull << 31)) {
+    data.resize(static_cast<size_t>(header.dataSize));
+    if (data.empty() ||
+        fread(&data[0], 1, data.size(), file) != data.size() ||
+        !IsCompatible(header, data)) {
+      data.clear();
+    }
+  }
+
+  fclose(file);
+  return data;
+}
+
+bool
+PipelineCache::IsCompatible(const FileHeader& header,
+                            const std::string& data) const
+{
+  if (header.magic != kMagic || header.version != kVersion ||
+      header.vendorID != props.vendorID || header.deviceID != props.deviceID ||
+      header.driverVersion != props.driverVersion ||
+      memcmp(header.pipelineCacheUUID,
+             props.pipelineCacheUUID,
+             VK_UUID_SIZE) != 0) {
+    return false;
+  }
+
+  // The data must carry the driver's own header version one, check it as
+  // well since not every driver validates it.
+  struct
+  {
+    uint32_t headerSize;
+    uint32_t headerVersion;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+  } cacheHeader;
+
+  if (data.size() < sizeof(cacheHeader))
+    return false;
+
+  memcpy(&cacheHeader, data.data(), sizeof(cacheHeader));
+
+  return cacheHeader.headerSize >= sizeof(cacheHeader) &&
+         cacheHeader.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+         cacheHeader.vendorID == props.vendorID &&
+         cacheHeader.deviceID == props.deviceID &&
+         memcmp(cacheHeader.pipelineCacheUUID,
+                props.pipelineCacheUUID,
+                VK_UUID_SIZE) == 0;
+}
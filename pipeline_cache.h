@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <vulkan/vulkan.h>
+
+// VkPipelineCache that is loaded from and saved to a file. The file starts
+// with a header naming the device and driver that produced the data; data of
+// another device, driver version or cache layout is dropped instead of being
+// handed to the driver.
+struct PipelineCache
+{
+  VkDevice device = VK_NULL_HANDLE;
+  VkPipelineCache handle = VK_NULL_HANDLE;
+  VkPhysicalDeviceProperties props = {};
+  std::string path;
+
+  PipelineCache(VkDevice device,
+                const VkPhysicalDeviceProperties& props,
+                const char* path);
+
+  PipelineCache(const PipelineCache&) = delete;
+  PipelineCache& operator=(const PipelineCache&) = delete;
+
+  // Saves the cache.
+  ~PipelineCache();
+
+  bool Save();
+
+private:
+  struct FileHeader
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+  };
+
+  static const uint32_t kMagic = 0x43505656; // "VVPC"
+  static const uint32_t kVersion = 1;
+
+  std::string Load();
+  bool IsCompatible(const FileHeader& header, const std::string& data) const;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+// Serializes pipeline descriptions into cache keys by appending the raw
+// bytes of Vulkan description structs. All structs written through the
+// generic overload consist of 32-bit members and handles only, so they carry
+// no padding. Structs holding pointers get an overload that writes the
+// pointed-to values.
+struct KeyWriter
+{
+  std::string bytes;
+
+  template<typename T>
+  void Write(const T& value)
+  {
+    bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  template<typename T>
+  void Write(const std::vector<T>& values)
+  {
+    Write(values.size());
+    for (const auto& value : values) {
+      Write(value);
+    }
+  }
+
+  void Write(const std::string& value)
+  {
+    bytes.append(value.c_str(), value.size() + 1);
+  }
+
+  void Write(const VkDescriptorSetLayoutBinding& binding)
+  {
+    Write(binding.binding);
+    Write(binding.descriptorType);
+    Write(binding.descriptorCount);
+    Write(binding.stageFlags);
+    Write(binding.pImmutableSamplers != nullptr);
+    if (binding.pImmutableSamplers) {
+      for (uint32_t i = 0; i < binding.descriptorCount; ++i) {
+        Write(binding.pImmutableSamplers[i]);
+      }
+    }
+  }
+};
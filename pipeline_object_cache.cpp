@@ -0,0 +1,198 @@
+#include "pipeline_object_cache.h"
+
+#include "pipeline_key.h"
+#include "vk_init.h"
+#include "vk_utils.h"
+
+namespace {
+
+template<typename T>
+std::shared_ptr<T>
+lockOrErase(std::unordered_map<std::string, std::weak_ptr<T>>& map,
+            const std::string& key)
+{
+  auto it = map.find(key);
+  if (it == map.end())
+    return nullptr;
+
+  auto object = it->second.lock();
+  if (!object) {
+    map.erase(it);
+  }
+  return object;
+}
+
+} // namespace
+
+DescriptorSetLayout::DescriptorSetLayout(
+  VkDevice device,
+  const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+  : device(device)
+{
+  auto info = vkiDescriptorSetLayoutCreateInfo(
+    static_cast<uint32_t>(bindings.size()), bindings.data());
+  ASSERT_VK_SUCCESS(
+    vkCreateDescriptorSetLayout(device, &info, nullptr, &handle));
+}
+
+DescriptorSetLayout::~DescriptorSetLayout()
+{
+  vkDestroyDescriptorSetLayout(device, handle, nullptr);
+}
+
+PipelineLayout::PipelineLayout(
+  VkDevice device,
+  std::vector<std::shared_ptr<DescriptorSetLayout>> owned,
+  const std::vector<VkDescriptorSetLayout>& setLayouts,
+  const std::vector<VkPushConstantRange>& pushConstantRanges)
+  : device(device)
+  , ownedSetLayouts(std::move(owned))
+{
+  auto info = vkiPipelineLayoutCreateInfo(
+    static_cast<uint32_t>(setLayouts.size()),
+    setLayouts.data(),
+    static_cast<uint32_t>(pushConstantRanges.size()),
+    pushConstantRanges.data());
+
+  ASSERT_VK_SUCCESS(vkCreatePipelineLayout(device, &info, nullptr, &handle));
+}
+
+PipelineLayout::~PipelineLayout()
+{
+  vkDestroyPipelineLayout(device, handle, nullptr);
+}
+
+std::shared_ptr<DescriptorSetLayout>
+PipelineObjectCache::GetDescriptorSetLayout(
+  VkDevice device,
+  const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+{
+  KeyWriter key;
+  key.Write(device);
+  key.Write(bindings);
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto layout = lockOrErase(descriptorSetLayouts, key.bytes);
+  if (!layout) {
+    layout = std::make_shared<DescriptorSetLayout>(device, bindings);
+    descriptorSetLayouts[key.bytes] = layout;
+  }
+  return layout;
+}
+
+std::shared_ptr<PipelineLayout>
+PipelineObjectCache::GetPipelineLayout(
+  VkDevice device,
+  std::vector<std::shared_ptr<DescriptorSetLayout>> owned,
+  const std::vector<VkDescriptorSetLayout>& setLayouts,
+  const std::vector<VkPushConstantRange>& pushConstantRanges)
+{
+  // Owned layouts are deduplicated already, their handles identify them.
+  KeyWriter key;
+  key.Write(device);
+  key.Write(setLayouts);
+  key.Write(pushConstantRanges);
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto layout = lockOrErase(pipelineLayouts, key.bytes);
+  if (!layout) {
+    layout = std::make_shared<PipelineLayout>(
+      device, std::move(owned), setLayouts, pushConstantRanges);
+    pipelineLayouts[key.bytes] = layout;
+  }
+  return layout;
+}
+
+std::shared_ptr<GraphicsPipeline>
+PipelineObjectCache::FindPipeline(const std::string& key)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto pipeline = lockOrErase(pipelines, key);
+  if (pipeline) {
+    ++stats.hits;
+  }
+  return pipeline;
+}
+
+std::shared_ptr<GraphicsPipeline>
+PipelineObjectCache::InsertPipeline(
+  const std::string& key,
+  std::shared_ptr<GraphicsPipeline> pipeline)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto existing = lockOrErase(pipelines, key);
+  if (existing) {
+    ++stats.hits;
+    return existing;
+  }
+
+  ++stats.misses;
+  pipelines[key] = pipeline;
+  return pipeline;
+}
+
+PipelineObjectCache::Stats
+PipelineObjectCache::GetStats()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return stats;
+}
+
+std::shared_ptr<ComputePipeline>
+PipelineObjectCache::FindComputePipeline(const std::string& key)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto pipeline = lockOrErase(computePipelines, key);
+  if (pipeline) {
+    ++stats.hits;
+  }
+  return pipeline;
+}
+
+std::shared_ptr<ComputePipeline>
+PipelineObjectCache::InsertComputePipeline(
+  const std::string& key,
+  std::shared_ptr<ComputePipeline> pipeline)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto existing = lockOrErase(computePipelines, key);
+  if (existing) {
+    ++stats.hits;
+    return existing;
+  }
+
+  ++stats.misses;
+  computePipelines[key] = pipeline;
+  return pipeline;
+}
+
+std::shared_ptr<PipelineLayout>
+buildPipelineLayout(
+  VkDevice device,
+  PipelineObjectCache* cache,
+  const std::vector<VkDescriptorSetLayout>& sharedLayouts,
+  const std::vector<std::vector<VkDescriptorSetLayoutBinding>>&
+    descriptorSetLayouts,
+  const std::vector<VkPushConstantRange>& pushConstantRanges)
+{
+  std::vector<std::shared_ptr<DescriptorSetLayout>> owned;
+  std::vector<VkDescriptorSetLayout> setLayouts = sharedLayouts;
+
+  for (const auto& bindings : descriptorSetLayouts) {
+    owned.push_back(
+      cache ? cache->GetDescriptorSetLayout(device, bindings)
+            : std::make_shared<DescriptorSetLayout>(device, bindings));
+    setLayouts.push_back(owned.back()->handle);
+  }
+
+  return cache ? cache->GetPipelineLayout(
+                   device, std::move(owned), setLayouts, pushConstantRanges)
+               : std::make_shared<PipelineLayout>(
+                   device, std::move(owned), setLayouts, pushConstantRanges);
+}
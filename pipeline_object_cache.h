@@ -0,0 +1,104 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan_core.h>
+
+struct GraphicsPipeline;
+struct ComputePipeline;
+
+// Ref-counted layout objects, shared between all pipelines built from the
+// same description when the builders use a PipelineObjectCache.
+struct DescriptorSetLayout
+{
+  VkDevice device = VK_NULL_HANDLE;
+  VkDescriptorSetLayout handle = VK_NULL_HANDLE;
+
+  DescriptorSetLayout(
+    VkDevice device,
+    const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+  DescriptorSetLayout(const DescriptorSetLayout&) = delete;
+  DescriptorSetLayout& operator=(const DescriptorSetLayout&) = delete;
+  ~DescriptorSetLayout();
+};
+
+struct PipelineLayout
+{
+  VkDevice device = VK_NULL_HANDLE;
+  VkPipelineLayout handle = VK_NULL_HANDLE;
+  std::vector<std::shared_ptr<DescriptorSetLayout>> ownedSetLayouts = {};
+
+  PipelineLayout(VkDevice device,
+                 std::vector<std::shared_ptr<DescriptorSetLayout>> owned,
+                 const std::vector<VkDescriptorSetLayout>& setLayouts,
+                 const std::vector<VkPushConstantRange>& pushConstantRanges);
+  PipelineLayout(const PipelineLayout&) = delete;
+  PipelineLayout& operator=(const PipelineLayout&) = delete;
+  ~PipelineLayout();
+};
+
+// Deduplicates pipelines and their layouts, graphics and compute pipelines
+// share the layouts. Objects are keyed by the full description they were
+// created from and handed out as shared pointers; the cache only holds weak
+// references, an object is destroyed with its last user. Keys contain raw
+// handles (shader modules, render pass, shared layouts), so equal state with
+// different handles is not merged.
+struct PipelineObjectCache
+{
+  struct Stats
+  {
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+  };
+
+  std::shared_ptr<DescriptorSetLayout> GetDescriptorSetLayout(
+    VkDevice device,
+    const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+
+  std::shared_ptr<PipelineLayout> GetPipelineLayout(
+    VkDevice device,
+    std::vector<std::shared_ptr<DescriptorSetLayout>> owned,
+    const std::vector<VkDescriptorSetLayout>& setLayouts,
+    const std::vector<VkPushConstantRange>& pushConstantRanges);
+
+  std::shared_ptr<GraphicsPipeline> FindPipeline(const std::string& key);
+  // Returns the pipeline already cached under key if another builder got
+  // there first, pipeline otherwise.
+  std::shared_ptr<GraphicsPipeline> InsertPipeline(
+    const std::string& key,
+    std::shared_ptr<GraphicsPipeline> pipeline);
+
+  std::shared_ptr<ComputePipeline> FindComputePipeline(
+    const std::string& key);
+  std::shared_ptr<ComputePipeline> InsertComputePipeline(
+    const std::string& key,
+    std::shared_ptr<ComputePipeline> pipeline);
+
+  Stats GetStats();
+
+private:
+  std::mutex mutex;
+  std::unordered_map<std::string, std::weak_ptr<DescriptorSetLayout>>
+    descriptorSetLayouts;
+  std::unordered_map<std::string, std::weak_ptr<PipelineLayout>>
+    pipelineLayouts;
+  std::unordered_map<std::string, std::weak_ptr<GraphicsPipeline>> pipelines;
+  std::unordered_map<std::string, std::weak_ptr<ComputePipeline>>
+    computePipelines;
+  Stats stats;
+};
+
+// Creates the set layouts described by descriptorSetLayouts and a pipeline
+// layout of sharedLayouts followed by them, through cache unless it is
+// nullptr. Used by both pipeline builders.
+std::shared_ptr<PipelineLayout>
+buildPipelineLayout(
+  VkDevice device,
+  PipelineObjectCache* cache,
+  const std::vector<VkDescriptorSetLayout>& sharedLayouts,
+  const std::vector<std::vector<VkDescriptorSetLayoutBinding>>&
+    descriptorSetLayouts,
+  const std::vector<VkPushConstantRange>& pushConstantRanges);
@@ -2,19 +2,29 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <cstdio>
 #include <iostream>
 
+#include "cpu_profiler.h"
 #include "vk_init.h"
 #include "vk_utils.h"
 
 Renderer::Renderer(VulkanWindow* window)
-  : VulkanBase(window)
+  : Renderer(window, Settings())
+{}
+
+Renderer::Renderer(VulkanWindow* window, Settings settings)
+  : VulkanBase(window, settings)
 {
   initialize();
   createDescriptorPool();
   createPipeline();
+  // Descriptor sets need the layouts, wait for the first pipeline.
+  pipeline = pendingPipeline.Wait();
   createBuffersAndSamplers();
   createDescriptorSets();
+  createRecordedCommandBuffers();
 }
 
 std::string
@@ -22,8 +32,7 @@ LoadFile(const char* _filename)
 {
   std::string buff;
 
-  FILE* file = 0;
-  fopen_s(&file, _filename, "rb");
+  FILE* file = fopen(_filename, "rb");
   if (file) {
     fseek(file, 0, SEEK_END);
     size_t bytes = ftell(file);
@@ -54,12 +63,18 @@ Renderer::initialize()
 {
   // load shader modules
   fragmentShaderModule = LoadShaderModule(device, "simple.frag.spv");
-  vertexShaderModule = LoadShaderModule(device, "simple.vert.spv");
+  vertexShaderModule = LoadShaderModule(
+    device, settings.packedVertices ? "packed.vert.spv" : "simple.vert.spv");
 }
 
 Renderer::~Renderer()
 {
+  // Submits copies still recorded into the buffers destroyed below.
+  uploader->Flush();
+  vkDeviceWaitIdle(device);
+  destroyRecordedCommandBuffers();
   destroyDescriptorSets();
+  destroyDescriptorPool();
   destroyBuffersAndSamplers();
   destroyPipeline();
 }
@@ -73,43 +88,84 @@ Renderer::createPipeline()
     VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
   colorBlendAttachment.blendEnable = VK_FALSE;
 
-  pipeline =
+  // Packed vertices take their dequantization as push constants.
+  auto instanceLayout = Instance::GetLayout();
+  std::vector<VkVertexInputBindingDescription> bindings;
+  std::vector<VkVertexInputAttributeDescription> attributes;
+  std::vector<VkPushConstantRange> pushConstantRanges;
+  if (settings.packedVertices) {
+    auto layout = PackedVertex::GetLayout();
+    bindings.push_back(layout.binding);
+    attributes = layout.attributes;
+    pushConstantRanges.push_back(
+      { VK_SHADER_STAGE_VERTEX_BIT, 0, 2 * sizeof(glm::vec4) });
+  } else {
+    auto layout = Vertex::GetLayout();
+    bindings.push_back(layout.binding);
+    attributes = layout.attributes;
+  }
+  bindings.push_back(instanceLayout.binding);
+  attributes.insert(attributes.end(),
+                    instanceLayout.attributes.begin(),
+                    instanceLayout.attributes.end());
+
+  pendingPipeline =
     GraphicsPipeline::GetBuilder()
       .SetDevice(device)
       .SetVertexShader(vertexShaderModule)
       .SetFragmentShader(fragmentShaderModule)
-      .SetVertexBindings({ Vertex::GetBindingDescription() })
-      .SetVertexAttributes(Vertex::GetAttributeDescriptions())
-      .SetDescriptorSetLayouts({ { { 0,
-                                     VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                                     1,
-                                     VK_SHADER_STAGE_VERTEX_BIT } } })
-      .SetViewports({ { 0.0f,
-                        0.0f,
-                        (float)swapchain->imageExtent.width,
-                        (float)swapchain->imageExtent.height,
-                        0.0f,
-                        1.0f } })
-      .SetScissors(
-        { { { 0, 0 },
-            { swapchain->imageExtent.width, swapchain->imageExtent.height } } })
+      .SetVertexBindings(bindings)
+      .SetVertexAttributes(attributes)
+      .SetDescriptorSetLayouts({ { vkiDescriptorSetLayoutBinding(
+        0,
+        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        1,
+        VK_SHADER_STAGE_VERTEX_BIT,
+        nullptr) } })
+      .SetPushConstantRanges(pushConstantRanges)
       .SetColorBlendAttachments({ colorBlendAttachment })
       .SetRenderPass(renderPass)
+      .SetPipelineCache(pipelineCache->handle)
+      .SetObjectCache(pipelineObjectCache)
       //.SetDepthWriteEnable(VK_TRUE)
       //.SetMaxDepthBounds(1.0)
       //.SetMinDepthBounds(0.0)
-      .Build();
+      .BuildAsync(*threadPool);
+  pipelineColorFormat = swapchain->surfaceFormat.format;
+}
+
+void
+Renderer::updatePipeline()
+{
+  if (!pendingPipeline.IsReady())
+    return;
+
+  pipeline = pendingPipeline.Wait();
+  pendingPipeline = {};
+  MarkDirty();
+
+  // Pipelines are rarely built, persist the cache right away instead of
+  // relying on a clean shutdown.
+  pipelineCache->Save();
 }
 
 void
 Renderer::destroyPipeline()
-{}
+{
+  if (pendingPipeline.IsValid()) {
+    pendingPipeline.Wait();
+    pendingPipeline = {};
+  }
+  pipeline.reset();
+}
 
 void
 Renderer::createDescriptorPool()
 {
-  auto poolSize = vkiDescriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1);
+  auto poolSize =
+    vkiDescriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1);
   auto info = vkiDescriptorPoolCreateInfo(1, 1, &poolSize);
+  info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
   vkCreateDescriptorPool(device, &info, nullptr, &descriptorPool);
 }
 
@@ -126,13 +182,13 @@ Renderer::createDescriptorSets()
     descriptorPool, 1, pipeline->descriptorSetLayouts.data());
   vkAllocateDescriptorSets(device, &info, &descriptorSet);
 
-  auto bufferInfo = vkiDescriptorBufferInfo(cameraBuffer, 0, sizeof(glm::mat4));
+  auto bufferInfo = uniformRing->GetDescriptorBufferInfo(sizeof(glm::mat4));
   auto descriptorWrite =
     vkiWriteDescriptorSet(descriptorSet,
                           0,
                           0,
                           1,
-                          VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                          VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
                           nullptr,
                           &bufferInfo,
                           nullptr);
@@ -159,117 +215,578 @@ Renderer::createBuffersAndSamplers()
     { { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, 1.0f } }
   };
 
+  // Shares the vertices both triangles use and orders them for the caches.
+  std::vector<uint32_t> indices;
+  meshStats = MeshOptimizer::Optimize(vertices, indices);
+
+  glm::vec3 boundsMin = vertices[0].pos;
+  glm::vec3 boundsMax = vertices[0].pos;
+  for (const auto& vertex : vertices) {
+    boundsMin = glm::min(boundsMin, vertex.pos);
+    boundsMax = glm::max(boundsMax, vertex.pos);
+  }
+  glm::vec3 boundsCenter = 0.5f * (boundsMin + boundsMax);
+  float radius = 0.0f;
+  for (const auto& vertex : vertices) {
+    radius = std::max(radius, glm::length(vertex.pos - boundsCenter));
+  }
+  boundingSphere = glm::vec4(boundsCenter, radius);
+
   vertexCount = vertices.size();
-  vertexBufferOffset = 0;
-
-  VkDeviceSize size = vertexCount * sizeof(Vertex);
-  vertexBuffer = vkuCreateBuffer(device,
-                                 size,
-                                 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-                                 VK_SHARING_MODE_EXCLUSIVE,
-                                 {});
-  vertexBufferMemory =
-    vkuAllocateBufferMemory(device,
-                            physicalDeviceProps.memProps,
-                            vertexBuffer,
-                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-                            true);
-  vkuTransferData(device, vertexBufferMemory, 0, size, vertices.data());
-
-  cameraBuffer = vkuCreateBuffer(device,
-                                 sizeof(glm::mat4),
-                                 VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                                 VK_SHARING_MODE_EXCLUSIVE,
-                                 {});
-  cameraBufferMemory =
-    vkuAllocateBufferMemory(device,
-                            physicalDeviceProps.memProps,
-                            cameraBuffer,
-                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
-                            true);
+  indexCount = static_cast<uint32_t>(indices.size());
+
+  // Half the index bandwidth whenever the vertex count allows it.
+  if (vertexCount <= 0x10000) {
+    std::vector<uint16_t> indices16(indices.begin(), indices.end());
+    indexType = VK_INDEX_TYPE_UINT16;
+    indexBuffer = new MeshBuffer(device,
+                                 allocator,
+                                 uploader,
+                                 VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                                 indices16.size() * sizeof(uint16_t),
+                                 indices16.data());
+  } else {
+    indexType = VK_INDEX_TYPE_UINT32;
+    indexBuffer = new MeshBuffer(device,
+                                 allocator,
+                                 uploader,
+                                 VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                                 indices.size() * sizeof(uint32_t),
+                                 indices.data());
+  }
+
+  // Uploaded with the first frame's batch unless written in place.
+  if (settings.packedVertices) {
+    quantization = PositionQuantization(boundsMin, boundsMax);
+
+    std::vector<PackedVertex> packed(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      packed[i].pos = quantization.Quantize(vertices[i].pos);
+      packed[i].color = PackColor(glm::vec4(vertices[i].color, 1.0f));
+    }
+
+    vertexBuffer = new MeshBuffer(device,
+                                  allocator,
+                                  uploader,
+                                  VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                  packed.size() * sizeof(PackedVertex),
+                                  packed.data());
+  } else {
+    vertexBuffer = new MeshBuffer(device,
+                                  allocator,
+                                  uploader,
+                                  VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                                  vertexCount * sizeof(Vertex),
+                                  vertices.data());
+  }
+
+  // Objects fill a cube around the origin, a single one sits at the origin.
+  uint32_t objectCount = std::max(settings.objectCount, 1u);
+  uint32_t side = 1;
+  while (side * side * side < objectCount) {
+    ++side;
+  }
+  const float spacing = 1.5f;
+  float center = 0.5f * (side - 1);
+  std::vector<Instance> instances(objectCount);
+  for (uint32_t i = 0; i < objectCount; ++i) {
+    glm::vec3 cell(i % side, (i / side) % side, i / (side * side));
+    instances[i].model = glm::mat4(1.0f);
+    instances[i].model[3] = glm::vec4((cell - center) * spacing, 1.0f);
+  }
+
+  if (settings.gpuCulling && computeQueueFamiliyIdx != queueFamiliyIdx) {
+    computeSharingFamilies = { queueFamiliyIdx, computeQueueFamiliyIdx };
+  }
+
+  uniformRing = new UniformRing(device,
+                                allocator,
+                                physicalDeviceProps.props,
+                                sizeof(glm::mat4),
+                                framesInFlight,
+                                computeSharingFamilies);
+
+  if (settings.gpuCulling) {
+    culler = new GpuCuller(device,
+                           allocator,
+                           pipelineCache->handle,
+                           pipelineObjectCache,
+                           uniformRing->GetDescriptorBufferInfo(
+                             sizeof(glm::mat4)),
+                           framesInFlight,
+                           HasAsyncCompute(),
+                           computeSharingFamilies);
+  } else if (settings.cpuCulling && !settings.indirectDraws) {
+    cpuCuller = new FrustumCuller();
+  }
+  createInstanceBuffer(instances);
 }
 
 void
 Renderer::destroyBuffersAndSamplers()
 {
-  vkDestroyBuffer(device, vertexBuffer, nullptr);
-  vkFreeMemory(device, vertexBufferMemory, nullptr);
+  delete cpuCuller;
+  delete culler;
+  delete uniformRing;
+  destroyInstanceBuffer();
+  delete indexBuffer;
+  delete vertexBuffer;
 }
 
 void
-Renderer::recordCommandBuffer(uint32_t idx)
+Renderer::createInstanceBuffer(const std::vector<Instance>& instances)
 {
+  instanceCount = static_cast<uint32_t>(instances.size());
+  // The culler reads the instances as a storage buffer.
+  VkBufferUsageFlags usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+  if (culler) {
+    usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  }
+  std::vector<uint32_t> otherQueueFamilies;
+  if (!computeSharingFamilies.empty()) {
+    otherQueueFamilies.push_back(computeQueueFamiliyIdx);
+  }
+  instanceBuffer = new MeshBuffer(device,
+                                  allocator,
+                                  uploader,
+                                  usage,
+                                  instances.size() * sizeof(Instance),
+                                  instances.data(),
+                                  otherQueueFamilies);
+
+  if (culler) {
+    culler->SetInstances(instanceBuffer->buffer, instanceCount);
+    // The compute queue does not wait for upload batches, the frames'
+    // submitUploads only orders them before the graphics queue.
+    if (HasAsyncCompute()) {
+      uploader->Flush();
+    }
+    return;
+  }
+
+  if (cpuCuller) {
+    std::vector<glm::vec4> spheres(instanceCount);
+    for (uint32_t i = 0; i < instanceCount; ++i) {
+      const glm::mat4& model = instances[i].model;
+      float scale = std::max(glm::length(glm::vec3(model[0])),
+                             std::max(glm::length(glm::vec3(model[1])),
+                                      glm::length(glm::vec3(model[2]))));
+      glm::vec4 center = model * glm::vec4(glm::vec3(boundingSphere), 1.0f);
+      spheres[i] = glm::vec4(glm::vec3(center), boundingSphere.w * scale);
+    }
+    cpuCuller->SetSpheres(spheres.data(), instanceCount);
+    visibleObjects.resize(instanceCount);
+    return;
+  }
+
+  if (!settings.indirectDraws)
+    return;
+
+  // A single pipeline and mesh for now, so everything ends up in one batch.
+  // Indirect commands must leave firstInstance at 0 without
+  // drawIndirectFirstInstance, one instanced command draws all objects then.
+  bool instanced = settings.instancing ||
+                   enabledFeatures.drawIndirectFirstInstance != VK_TRUE;
+  std::vector<DrawBatcher::Draw> draws(instanced ? 1 : instanceCount);
+  for (uint32_t i = 0; i < draws.size(); ++i) {
+    VkDrawIndexedIndirectCommand& command = draws[i].command;
+    command.indexCount = indexCount;
+    command.instanceCount = instanced ? instanceCount : 1;
+    command.firstInstance = i;
+  }
+
+  std::vector<VkDrawIndexedIndirectCommand> commands;
+  drawBatches = DrawBatcher::Build(draws, commands);
+  drawCommandBuffer =
+    new MeshBuffer(device,
+                   allocator,
+                   uploader,
+                   VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                   commands.size() * sizeof(VkDrawIndexedIndirectCommand),
+                   commands.data());
+}
+
+void
+Renderer::destroyInstanceBuffer()
+{
+  delete drawCommandBuffer;
+  drawCommandBuffer = nullptr;
+  drawBatches.clear();
+  delete instanceBuffer;
+  instanceBuffer = nullptr;
+}
+
+void
+Renderer::SetInstances(const std::vector<Instance>& instances)
+{
+  ASSERT_TRUE(!instances.empty());
+  // The old buffers may still be copy targets of the open upload batch.
+  uploader->Flush();
+  vkDeviceWaitIdle(device);
+  destroyInstanceBuffer();
+  createInstanceBuffer(instances);
+  MarkDirty();
+}
+
+void
+Renderer::createRecordedCommandBuffers()
+{
+  if (!settings.reuseCommandBuffers)
+    return;
+
+  uint32_t count = framesInFlight * swapchain->imageCount;
+  std::vector<VkCommandBuffer> handles(count);
+  auto allocateInfo = vkiCommandBufferAllocateInfo(
+    cmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, count);
   ASSERT_VK_SUCCESS(
-    vkWaitForFences(device, 1, &fences[idx], true, (uint64_t)-1));
-  ASSERT_VK_SUCCESS(vkResetFences(device, 1, &fences[idx]));
-  ASSERT_VK_SUCCESS(vkResetCommandBuffer(commandBuffers[idx], 0));
+    vkAllocateCommandBuffers(device, &allocateInfo, handles.data()));
 
+  recordedCommandBuffers.resize(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    recordedCommandBuffers[i].handle = handles[i];
+  }
+}
+
+void
+Renderer::destroyRecordedCommandBuffers()
+{
+  for (const auto& recorded : recordedCommandBuffers) {
+    vkFreeCommandBuffers(device, cmdPool, 1, &recorded.handle);
+  }
+  recordedCommandBuffers.clear();
+}
+
+void
+Renderer::submitUploads(const Frame& frame)
+{
+  PROFILE_SCOPE("Renderer::submitUploads");
+  uploadScope = (uint32_t)-1;
+
+  if (!gpuProfiler->IsSupported() || !uploader->HasPendingCopies() ||
+      uploader->ownershipTransfer) {
+    uploader->Submit();
+    return;
+  }
+
+  // The batch runs before the frame's command buffer, reset the queries and
+  // open the scope in a prologue submitted with it.
+  VkCommandBuffer cmd = frame.prologueCommandBuffer;
+  ResetFrameCommandBuffer(cmd);
   VkCommandBufferBeginInfo beginInfo = vkiCommandBufferBeginInfo(nullptr);
-  ASSERT_VK_SUCCESS(vkBeginCommandBuffer(commandBuffers[idx], &beginInfo));
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  ASSERT_VK_SUCCESS(vkBeginCommandBuffer(cmd, &beginInfo));
+  gpuProfiler->CmdReset(cmd);
+  uploadScope = gpuProfiler->CmdBeginScope(cmd, "upload");
+  ASSERT_VK_SUCCESS(vkEndCommandBuffer(cmd));
+
+  uploader->Submit(cmd);
+}
+
+VkCommandBuffer
+Renderer::getCommandBuffer(const Frame& frame, uint32_t imageIdx)
+{
+  if (recordedCommandBuffers.empty()) {
+    recordCommandBuffer(frame.commandBuffer, imageIdx, true);
+    return frame.commandBuffer;
+  }
+
+  RecordedCommandBuffer& recorded =
+    recordedCommandBuffers[frameIdx * swapchain->imageCount + imageIdx];
+
+  // The slot's fence signalled, the buffer is no longer executing.
+  // Culled draws change with the camera, they are always recorded again.
+  if (recorded.version == sceneVersion &&
+      recorded.cameraOffset == cameraOffset && uploadScope == (uint32_t)-1 &&
+      !cpuCuller) {
+    gpuProfiler->ReplayScopes(recorded.profilerScopes);
+    return recorded.handle;
+  }
+
+  recordCommandBuffer(recorded.handle, imageIdx, false);
+  recorded.cameraOffset = cameraOffset;
+  recorded.profilerScopes = gpuProfiler->GetFrameScopes();
+  // Closing the upload scope is specific to this frame.
+  recorded.version = uploadScope == (uint32_t)-1 ? sceneVersion : 0;
+
+  return recorded.handle;
+}
+
+void
+Renderer::recordCommandBuffer(VkCommandBuffer cmd,
+                              uint32_t imageIdx,
+                              bool oneTimeSubmit)
+{
+  PROFILE_SCOPE("Renderer::recordCommandBuffer");
+  VkCommandBufferBeginInfo beginInfo = vkiCommandBufferBeginInfo(nullptr);
+  if (oneTimeSubmit) {
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    ResetFrameCommandBuffer(cmd);
+  } else {
+    // Kept buffers live in cmdPool and are reset one by one.
+    ASSERT_VK_SUCCESS(vkResetCommandBuffer(cmd, 0));
+  }
+  ASSERT_VK_SUCCESS(vkBeginCommandBuffer(cmd, &beginInfo));
+
+  // The end timestamp waits for the upload batch submitted before.
+  if (uploadScope != (uint32_t)-1) {
+    gpuProfiler->CmdEndScope(cmd, uploadScope);
+  } else {
+    gpuProfiler->CmdReset(cmd);
+  }
+  uint32_t frameScope = gpuProfiler->CmdBeginScope(cmd, "frame");
+
+  if (culler && !HasAsyncCompute()) {
+    uint32_t cullScope = gpuProfiler->CmdBeginScope(cmd, "cull");
+    culler->CmdCull(cmd, frameIdx, cameraOffset, boundingSphere, indexCount);
+    gpuProfiler->CmdEndScope(cmd, cullScope);
+  }
 
   VkClearValue clearValues[] = { { 0.0f, 0.0f, 0.0f, 1.0f }, { 1.f, 0 } };
   VkRenderPassBeginInfo renderPassInfo =
     vkiRenderPassBeginInfo(renderPass,
-                           framebuffers[idx],
+                           framebuffers[imageIdx],
                            { { 0, 0 }, swapchain->imageExtent },
                            2,
                            clearValues);
 
-  vkCmdBeginRenderPass(
-    commandBuffers[idx], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-  vkCmdBindPipeline(
-    commandBuffers[idx], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline);
-  vkCmdBindVertexBuffers(
-    commandBuffers[idx], 0, 1, &vertexBuffer, &vertexBufferOffset);
-  vkCmdBindDescriptorSets(commandBuffers[idx],
+  // Only clear while the first compatible pipeline is still compiling. A
+  // single instanced draw is not worth another thread.
+  bool secondary = pipeline && oneTimeSubmit && !culler &&
+                   !settings.instancing && !settings.indirectDraws &&
+                   recorder->threadCount > 1;
+
+  uint32_t renderPassScope = gpuProfiler->CmdBeginScope(cmd, "renderPass");
+  vkCmdBeginRenderPass(cmd,
+                       &renderPassInfo,
+                       secondary ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                                 : VK_SUBPASS_CONTENTS_INLINE);
+
+  if (secondary) {
+    // Queries cannot span secondary command buffers without inheritedQueries,
+    // the renderPass scope times the draws instead of a statistics scope.
+    auto inheritance = vkiCommandBufferInheritanceInfo(
+      renderPass, 0, framebuffers[imageIdx], VK_FALSE, 0, 0);
+    std::vector<VkCommandBuffer> secondaries = recorder->Record(
+      inheritance,
+      cpuCuller ? visibleCount : instanceCount,
+      [this](VkCommandBuffer cmd, uint32_t first, uint32_t count) {
+        bindScene(cmd);
+        drawObjects(cmd, first, count);
+      });
+    vkCmdExecuteCommands(
+      cmd, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+  } else if (pipeline) {
+    bindScene(cmd);
+    uint32_t drawScope = gpuProfiler->CmdBeginScope(cmd, "draw", true);
+    if (culler) {
+      vkCmdDrawIndexedIndirect(cmd,
+                               culler->outputs[frameIdx].drawCommandBuffer,
+                               0,
+                               1,
+                               sizeof(VkDrawIndexedIndirectCommand));
+    } else if (settings.indirectDraws) {
+      drawIndirect(cmd);
+    } else {
+      drawObjects(cmd, 0, cpuCuller ? visibleCount : instanceCount);
+    }
+    gpuProfiler->CmdEndScope(cmd, drawScope);
+  }
+
+  vkCmdEndRenderPass(cmd);
+  gpuProfiler->CmdEndScope(cmd, renderPassScope);
+  gpuProfiler->CmdEndScope(cmd, frameScope);
+
+  ASSERT_VK_SUCCESS(vkEndCommandBuffer(cmd));
+}
+
+void
+Renderer::bindScene(VkCommandBuffer cmd)
+{
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline);
+
+  VkViewport viewport = { 0.0f,
+                          0.0f,
+                          (float)swapchain->imageExtent.width,
+                          (float)swapchain->imageExtent.height,
+                          0.0f,
+                          1.0f };
+  VkRect2D scissor = { { 0, 0 }, swapchain->imageExtent };
+  vkCmdSetViewport(cmd, 0, 1, &viewport);
+  vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+  VkBuffer vertexBuffers[] = { vertexBuffer->buffer,
+                               culler ? culler->outputs[frameIdx].visibleBuffer
+                                      : instanceBuffer->buffer };
+  VkDeviceSize vertexBufferOffsets[] = { 0, 0 };
+  vkCmdBindVertexBuffers(cmd, 0, 2, vertexBuffers, vertexBufferOffsets);
+  vkCmdBindIndexBuffer(cmd, indexBuffer->buffer, 0, indexType);
+
+  if (settings.packedVertices) {
+    glm::vec4 dequantization[] = { glm::vec4(quantization.scale, 0.0f),
+                                   glm::vec4(quantization.bias, 0.0f) };
+    vkCmdPushConstants(cmd,
+                       pipeline->pipelineLayout,
+                       VK_SHADER_STAGE_VERTEX_BIT,
+                       0,
+                       sizeof(dequantization),
+                       dequantization);
+  }
+  vkCmdBindDescriptorSets(cmd,
                           VK_PIPELINE_BIND_POINT_GRAPHICS,
                           pipeline->pipelineLayout,
                           0,
                           1,
                           &descriptorSet,
-                          0,
-                          nullptr);
-  vkCmdDraw(commandBuffers[idx], static_cast<uint32_t>(vertexCount), 1, 0, 0);
-  vkCmdEndRenderPass(commandBuffers[idx]);
-  ASSERT_VK_SUCCESS(vkEndCommandBuffer(commandBuffers[idx]));
+                          1,
+                          &cameraOffset);
+}
+
+void
+Renderer::drawObjects(VkCommandBuffer cmd, uint32_t first, uint32_t count)
+{
+  if (cpuCuller) {
+    const uint32_t* objects = visibleObjects.data() + first;
+    uint32_t i = 0;
+    while (i < count) {
+      // Instanced, runs of neighbouring objects share one draw.
+      uint32_t run = 1;
+      while (settings.instancing && i + run < count &&
+             objects[i + run] == objects[i] + run) {
+        ++run;
+      }
+      vkCmdDrawIndexed(cmd, indexCount, run, 0, 0, objects[i]);
+      i += run;
+    }
+    return;
+  }
+
+  if (settings.instancing) {
+    vkCmdDrawIndexed(cmd, indexCount, count, 0, 0, first);
+    return;
+  }
+
+  // One draw per object, firstInstance selects its model matrix.
+  for (uint32_t i = first; i < first + count; ++i) {
+    vkCmdDrawIndexed(cmd, indexCount, 1, 0, 0, i);
+  }
+}
+
+void
+Renderer::drawIndirect(VkCommandBuffer cmd)
+{
+  for (const auto& batch : drawBatches) {
+    // bindScene bound the only pipeline and mesh, more would be bound here
+    // by batch.pipelineIdx and batch.meshIdx.
+    DrawBatcher::CmdDraw(cmd,
+                         drawCommandBuffer->buffer,
+                         batch,
+                         enabledFeatures.multiDrawIndirect == VK_TRUE,
+                         physicalDeviceProps.props.limits.maxDrawIndirectCount);
+  }
 }
 
 void
 Renderer::drawFrame(const glm::mat4& vp)
 {
-  uint32_t nextImageIdx = -1;
-  ASSERT_VK_SUCCESS(vkAcquireNextImageKHR(device,
-                                          swapchain->handle,
-                                          UINT64_MAX,
-                                          imageAvailableSemaphore,
-                                          VK_NULL_HANDLE,
-                                          &nextImageIdx));
+  PROFILE_SCOPE("Renderer::drawFrame");
+  using Clock = std::chrono::steady_clock;
+  using Ms = std::chrono::duration<double, std::milli>;
 
-  recordCommandBuffer(nextImageIdx);
+  Frame& frame = BeginFrame();
+  gpuProfiler->BeginFrame(frameIdx);
+  timings.gpuMs = gpuProfiler->GetScopeMs("frame");
+  updatePipeline();
 
-  vkuTransferData(
-    device, cameraBufferMemory, 0, sizeof(glm::mat4), (void*)(&vp));
+  uint32_t nextImageIdx = AcquireNextImage(frame);
 
-  VkPipelineStageFlags waitStages[] = {
-    VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
-  };
-  VkSubmitInfo submitInfo = vkiSubmitInfo(1,
-                                          &imageAvailableSemaphore,
-                                          waitStages,
-                                          1,
-                                          &commandBuffers[nextImageIdx],
-                                          1,
-                                          &renderFinishedSemaphore);
-  ASSERT_VK_SUCCESS(vkQueueSubmit(queue, 1, &submitInfo, fences[nextImageIdx]));
-
-  VkPresentInfoKHR presentInfo = vkiPresentInfoKHR(
-    1, &renderFinishedSemaphore, 1, &swapchain->handle, &nextImageIdx, nullptr);
-  ASSERT_VK_SUCCESS(vkQueuePresentKHR(queue, &presentInfo));
+  WaitForImage(nextImageIdx);
+
+  // The slot's fence has signalled, no submitted frame reads its region.
+  uniformRing->BeginFrame(frameIdx);
+  cameraOffset = uniformRing->Push(vp);
+  uniformRing->Flush();
+
+  // Uploads recorded since the last frame go first, the batch's closing
+  // barrier orders them before this frame's reads.
+  submitUploads(frame);
+
+  // Culls on the GPU while the CPU records the draws.
+  if (culler && HasAsyncCompute()) {
+    submitCompute(frame);
+  }
+
+  auto recordStart = Clock::now();
+  if (cpuCuller) {
+    visibleCount = cpuCuller->Cull(vp, visibleObjects.data());
+  }
+  VkCommandBuffer cmd = getCommandBuffer(frame, nextImageIdx);
+  timings.recordMs = Ms(Clock::now() - recordStart).count();
+
+  // Offscreen images need no acquire or present semaphores.
+  uint32_t semaphoreCount = IsHeadless() ? 0 : 1;
+  std::vector<VkSemaphore> waitSemaphores;
+  std::vector<VkPipelineStageFlags> waitStages;
+  if (!IsHeadless()) {
+    waitSemaphores.push_back(frame.imageAvailableSemaphore);
+    waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+  }
+  if (culler && HasAsyncCompute()) {
+    waitSemaphores.push_back(frame.computeFinishedSemaphore);
+    waitStages.push_back(VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                         VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+  }
+  VkSubmitInfo submitInfo =
+    vkiSubmitInfo(static_cast<uint32_t>(waitSemaphores.size()),
+                  waitSemaphores.data(),
+                  waitStages.data(),
+                  1,
+                  &cmd,
+                  semaphoreCount,
+                  &frame.renderFinishedSemaphore);
+  auto submitStart = Clock::now();
+  {
+    PROFILE_SCOPE("vkQueueSubmit");
+    ASSERT_VK_SUCCESS(vkQueueSubmit(queue, 1, &submitInfo, frame.fence));
+  }
+  auto presentStart = Clock::now();
+  Present(frame, nextImageIdx);
+  auto presentEnd = Clock::now();
+
+  timings.submitMs = Ms(presentStart - submitStart).count();
+  timings.presentMs = Ms(presentEnd - presentStart).count();
+
+  EndFrame();
+}
+
+void
+Renderer::submitCompute(const Frame& frame)
+{
+  PROFILE_SCOPE("Renderer::submitCompute");
+  VkCommandBuffer cmd = frame.computeCommandBuffer;
+  VkCommandBufferBeginInfo beginInfo = vkiCommandBufferBeginInfo(nullptr);
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  ASSERT_VK_SUCCESS(vkBeginCommandBuffer(cmd, &beginInfo));
+  culler->CmdCull(cmd, frameIdx, cameraOffset, boundingSphere, indexCount);
+  ASSERT_VK_SUCCESS(vkEndCommandBuffer(cmd));
+
+  VkSubmitInfo submitInfo = vkiSubmitInfo(
+    0, nullptr, nullptr, 1, &cmd, 1, &frame.computeFinishedSemaphore);
+  ASSERT_VK_SUCCESS(
+    vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE));
 }
 
 void
 Renderer::OnSwapchainReinitialized()
 {
-  destroyPipeline();
-  createPipeline();
+  // Framebuffers and possibly the image count changed.
+  destroyRecordedCommandBuffers();
+  createRecordedCommandBuffers();
+
+  // Viewport and scissor are dynamic, only a new attachment format makes the
+  // pipeline incompatible with the recreated render pass.
+  if (swapchain->surfaceFormat.format != pipelineColorFormat) {
+    destroyPipeline();
+    createPipeline();
+  }
+  updatePipeline();
 }
@@ -1,9 +1,17 @@
 #pragma once
 
-#include <glm\glm.hpp>
+#include <glm/glm.hpp>
+#include <memory>
 #include <tuple>
 
+#include "draw_batcher.h"
+#include "frustum_culler.h"
+#include "gpu_culler.h"
 #include "graphics_pipeline.h"
+#include "mesh_buffer.h"
+#include "mesh_optimizer.h"
+#include "uniform_ring.h"
+#include "vertex_layout.h"
 #include "vk_base.h"
 
 struct Vertex
@@ -11,32 +19,37 @@ struct Vertex
   glm::vec3 pos;
   glm::vec3 color;
 
-  static VkVertexInputBindingDescription GetBindingDescription()
+  static VertexLayout<Vertex> GetLayout()
   {
-    VkVertexInputBindingDescription bindingDescription = {};
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(Vertex);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-    return bindingDescription;
+    return VertexLayout<Vertex>(0).Add(&Vertex::pos).Add(&Vertex::color);
   }
+};
 
-  static std::vector<VkVertexInputAttributeDescription>
-  GetAttributeDescriptions()
-  {
-    std::vector<VkVertexInputAttributeDescription> attributeDescriptions(2);
+// Half the size of Vertex, used with Settings::packedVertices. Positions are
+// quantized to the mesh bounds, see PositionQuantization, the w component
+// and the color's alpha are unused.
+struct PackedVertex
+{
+  Unorm16x4 pos;
+  Unorm8x4 color;
 
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[0].offset = offsetof(Vertex, pos);
+  static VertexLayout<PackedVertex> GetLayout()
+  {
+    return VertexLayout<PackedVertex>(0)
+      .Add(&PackedVertex::pos)
+      .Add(&PackedVertex::color);
+  }
+};
 
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[1].offset = offsetof(Vertex, color);
+// Per-instance attributes, binding 1.
+struct Instance
+{
+  glm::mat4 model;
 
-    return attributeDescriptions;
+  static VertexLayout<Instance> GetLayout()
+  {
+    return VertexLayout<Instance>(1, VK_VERTEX_INPUT_RATE_INSTANCE)
+      .Add(&Instance::model, 2);
   }
 };
 
@@ -44,29 +57,130 @@ struct Renderer : VulkanBase
 {
 public:
   Renderer(VulkanWindow* window);
+  Renderer(VulkanWindow* window, Settings settings);
   ~Renderer();
 
   void drawFrame(const glm::mat4& vp);
 
+  struct FrameTimings
+  {
+    // GPU time of the latest frame whose results came back, they trail by
+    // framesInFlight frames. -1 if there is none or profiling is off. See
+    // gpuProfiler for the breakdown.
+    double gpuMs = -1.0;
+    // CPU time spent recording the command buffers, culling included, in
+    // vkQueueSubmit and in presenting.
+    double recordMs = 0.0;
+    double submitMs = 0.0;
+    double presentMs = 0.0;
+  };
+
+  // Updated by every drawFrame.
+  FrameTimings timings;
+
+  // Import statistics of the scene geometry.
+  MeshOptimizer::Stats meshStats;
+  VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+
+  // Replaces the objects drawn, initially a grid of Settings::objectCount.
+  // Waits for the device to go idle, the old instances may still be read.
+  void SetInstances(const std::vector<Instance>& instances);
+
+  // Makes drawFrame record the command buffers kept with
+  // Settings::reuseCommandBuffers again, call after changing anything they
+  // record. The camera needs no call, it is read from the uniform ring.
+  void MarkDirty() { ++sceneVersion; }
+
 private:
   virtual void OnSwapchainReinitialized();
 
-  GraphicsPipeline* pipeline;
+  // The pipeline in use and the one compiling in the background. Frames are
+  // rendered with the former until the latter is ready.
+  std::shared_ptr<GraphicsPipeline> pipeline;
+  GraphicsPipeline::Pending pendingPipeline;
+  // Render pass format the pipeline was built for. Render passes recreated
+  // with the same format stay compatible with it.
+  VkFormat pipelineColorFormat = VK_FORMAT_UNDEFINED;
   VkShaderModule vertexShaderModule;
   VkShaderModule fragmentShaderModule;
 
-  VkBuffer vertexBuffer;
-  VkDeviceMemory vertexBufferMemory;
+  MeshBuffer* vertexBuffer = nullptr;
   VkDeviceSize vertexCount;
-  VkDeviceSize vertexBufferOffset;
+  MeshBuffer* indexBuffer = nullptr;
+  uint32_t indexCount = 0;
+  // One instance per object, see Settings::instancing for how they are
+  // drawn.
+  MeshBuffer* instanceBuffer = nullptr;
+  uint32_t instanceCount = 0;
+  // Settings::gpuCulling only, instances are drawn from its output. The pass
+  // runs on computeQueue when that is a queue of its own.
+  GpuCuller* culler = nullptr;
+  // Families of queue and computeQueue if they differ, buffers both read or
+  // write are shared concurrently between them.
+  std::vector<uint32_t> computeSharingFamilies;
+  // Settings::cpuCulling only, the world space bounds of every object and
+  // the objects drawn in the current frame.
+  FrustumCuller* cpuCuller = nullptr;
+  std::vector<uint32_t> visibleObjects;
+  uint32_t visibleCount = 0;
+  // Mesh bounds in model space, center and radius.
+  glm::vec4 boundingSphere;
+  // Settings::indirectDraws only, the commands of all batches.
+  MeshBuffer* drawCommandBuffer = nullptr;
+  std::vector<DrawBatcher::Batch> drawBatches;
+  // Reverses the position quantization of packed vertices.
+  PositionQuantization quantization;
 
   VkDescriptorPool descriptorPool;
   VkDescriptorSet descriptorSet;
 
-  VkBuffer cameraBuffer;
-  VkDeviceMemory cameraBufferMemory;
+  // Per-frame constants live in a persistently mapped ring, the descriptor
+  // set is bound with the dynamic offset returned when pushing them.
+  UniformRing* uniformRing;
+  uint32_t cameraOffset;
 
-  void recordCommandBuffer(uint32_t idx);
+  // Profiler scope of the upload batch timed ahead of the current frame,
+  // closed by the frame's command buffer. -1 if there is none.
+  uint32_t uploadScope = (uint32_t)-1;
+
+  // Command buffer kept for one frame slot and swapchain image.
+  struct RecordedCommandBuffer
+  {
+    VkCommandBuffer handle = VK_NULL_HANDLE;
+    // sceneVersion it was recorded at, 0 if it must be recorded.
+    uint64_t version = 0;
+    // Bound as the descriptor set's dynamic offset.
+    uint32_t cameraOffset = 0;
+    // Written by the command buffer, handed to the profiler on every replay.
+    std::vector<GpuProfiler::Scope> profilerScopes = {};
+  };
+
+  // framesInFlight * imageCount, slot major. Empty unless
+  // settings.reuseCommandBuffers is set.
+  std::vector<RecordedCommandBuffer> recordedCommandBuffers;
+  uint64_t sceneVersion = 1;
+
+  // Submits pending uploads, timed by the profiler when they run on the
+  // frame's queue.
+  void submitUploads(const Frame& frame);
+  // Async compute only, records and submits the frame's culling pass. The
+  // frame's graphics work waits for frame.computeFinishedSemaphore.
+  void submitCompute(const Frame& frame);
+  // Returns the command buffer to submit for the frame, recorded now or
+  // kept from an earlier frame in the same slot rendering to imageIdx.
+  VkCommandBuffer getCommandBuffer(const Frame& frame, uint32_t imageIdx);
+  // Secondary command buffers only live until the slot is reused, buffers
+  // submitted more than once record inline.
+  void recordCommandBuffer(VkCommandBuffer cmd,
+                           uint32_t imageIdx,
+                           bool oneTimeSubmit);
+  // Binds everything the draws need. Secondary command buffers inherit no
+  // state, each one binds again.
+  void bindScene(VkCommandBuffer cmd);
+  // Draws objects [first, first + count) of the frame, only the visible ones
+  // with Settings::cpuCulling.
+  void drawObjects(VkCommandBuffer cmd, uint32_t first, uint32_t count);
+  void drawIndirect(VkCommandBuffer cmd);
 
 private:
   void initialize();
@@ -74,6 +188,8 @@ private:
   void destroyDescriptorPool();
 
   void createPipeline();
+  // Switches to the pending pipeline once it finished compiling.
+  void updatePipeline();
   void destroyPipeline();
 
   void createDescriptorSets();
@@ -81,4 +197,10 @@ private:
 
   void createBuffersAndSamplers();
   void destroyBuffersAndSamplers();
+  // Also creates the indirect draw commands of the instances.
+  void createInstanceBuffer(const std::vector<Instance>& instances);
+  void destroyInstanceBuffer();
+
+  void createRecordedCommandBuffers();
+  void destroyRecordedCommandBuffers();
 };
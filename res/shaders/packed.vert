@@ -0,0 +1,30 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// simple.vert for PackedVertex: positions are R16G16B16A16_UNORM inside the
+// mesh bounds, colors R8G8B8A8_UNORM.
+layout(location = 0) in vec4 p;
+layout(location = 1) in vec4 c;
+// Per instance, takes locations 2 to 5.
+layout(location = 2) in mat4 model;
+
+layout(set = 0, binding = 0) uniform global_uniform {
+    mat4 vp;
+} global;
+
+layout(push_constant) uniform mesh_constants {
+    vec4 dequantScale;
+    vec4 dequantBias;
+} mesh;
+
+layout(location = 0) out vec3 fragColor;
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+void main() {
+    vec3 position = p.xyz * mesh.dequantScale.xyz + mesh.dequantBias.xyz;
+    gl_Position =  global.vp * model * vec4(position, 1.0);
+    fragColor = c.rgb;
+}
@@ -3,6 +3,8 @@
 
 layout(location = 0) in vec3 p;
 layout(location = 1) in vec3 c;
+// Per instance, takes locations 2 to 5.
+layout(location = 2) in mat4 model;
 
 layout(set = 0, binding = 0) uniform global_uniform {
     mat4 vp;
@@ -15,6 +17,6 @@ out gl_PerVertex {
 };
 
 void main() {
-    gl_Position =  global.vp * vec4(p, 1.0);
+    gl_Position =  global.vp * model * vec4(p, 1.0);
     fragColor = c;
 }
\ No newline at end of file
@@ -0,0 +1,52 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+#include "cpu_profiler.h"
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+  if (threadCount == 0) {
+    threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+  }
+
+  for (uint32_t i = 0; i < threadCount; ++i) {
+    workers.emplace_back(&ThreadPool::Run, this);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  wakeup.notify_all();
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+void
+ThreadPool::Run()
+{
+  CpuProfiler::SetThreadName("ThreadPool worker");
+
+  for (;;) {
+    std::function<void()> task;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wakeup.wait(lock, [this]() { return stop || !tasks.empty(); });
+      if (tasks.empty())
+        return;
+
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+
+    PROFILE_SCOPE("ThreadPool task");
+    task();
+  }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads executing submitted tasks in FIFO order.
+struct ThreadPool
+{
+  // Zero picks one thread less than there are hardware threads, the main
+  // thread keeps a core for itself.
+  explicit ThreadPool(uint32_t threadCount = 0);
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Finishes all queued tasks before joining.
+  ~ThreadPool();
+
+  template<typename F>
+  auto Submit(F task) -> std::future<decltype(task())>
+  {
+    typedef decltype(task()) Result;
+    auto packaged =
+      std::make_shared<std::packaged_task<Result()>>(std::move(task));
+    std::future<Result> future = packaged->get_future();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back([packaged]() { (*packaged)(); });
+    }
+    wakeup.notify_one();
+
+    return future;
+  }
+
+  uint32_t GetThreadCount() const
+  {
+    return static_cast<uint32_t>(workers.size());
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  bool stop = false;
+
+  void Run();
+};
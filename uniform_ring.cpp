@@ -0,0 +1,91 @@
+#include "uniform_ring.h"
+
+#include <algorithm>
+
+#include "vk_init.h"
+#include "vk_utils.h"
+
+static VkDeviceSize
+alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+UniformRing::UniformRing(VkDevice device,
+                         MemoryAllocator* allocator,
+                         const VkPhysicalDeviceProperties& props,
+                         VkDeviceSize frameSize,
+                         uint32_t frameCount,
+                         const std::vector<uint32_t>& queueFamilies)
+  : device(device)
+  , allocator(allocator)
+  , frameCount(frameCount)
+{
+  alignment = std::max(props.limits.minUniformBufferOffsetAlignment,
+                       props.limits.nonCoherentAtomSize);
+  this->frameSize = alignUp(frameSize, alignment);
+
+  buffer = vkuCreateBuffer(device,
+                           this->frameSize * frameCount,
+                           VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                           queueFamilies.size() > 1
+                             ? VK_SHARING_MODE_CONCURRENT
+                             : VK_SHARING_MODE_EXCLUSIVE,
+                           queueFamilies);
+  ASSERT_VK_VALID_HANDLE(buffer);
+
+  // Prefer coherent memory, it saves the flush per frame.
+  allocation = allocator->AllocateForBuffer(
+    buffer,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+  if (!allocation.IsValid()) {
+    allocation =
+      allocator->AllocateForBuffer(buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+  }
+  ASSERT_TRUE(allocation.IsValid());
+
+  mapped = static_cast<uint8_t*>(allocation.mapped);
+}
+
+UniformRing::~UniformRing()
+{
+  vkDestroyBuffer(device, buffer, nullptr);
+  allocator->Free(allocation);
+}
+
+void
+UniformRing::BeginFrame(uint32_t frameIdx)
+{
+  this->frameIdx = frameIdx;
+  head = 0;
+  flushed = 0;
+}
+
+uint32_t
+UniformRing::Push(const void* data, VkDeviceSize size)
+{
+  ASSERT_TRUE(head + size <= frameSize);
+
+  VkDeviceSize offset = frameIdx * frameSize + head;
+  memcpy(mapped + offset, data, size);
+  head = alignUp(head + size, alignment);
+
+  return static_cast<uint32_t>(offset);
+}
+
+void
+UniformRing::Flush()
+{
+  if (head == flushed)
+    return;
+
+  allocator->Flush(allocation, frameIdx * frameSize + flushed, head - flushed);
+  flushed = head;
+}
+
+VkDescriptorBufferInfo
+UniformRing::GetDescriptorBufferInfo(VkDeviceSize range) const
+{
+  return vkiDescriptorBufferInfo(buffer, 0, range);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "memory_allocator.h"
+
+// Host-visible uniform buffer that stays mapped for its whole lifetime. The
+// buffer holds one region per frame in flight. Push() appends to the region of
+// the current frame and returns the offset to pass as dynamic offset when
+// binding a VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC descriptor.
+struct UniformRing
+{
+  VkDevice device = VK_NULL_HANDLE;
+  MemoryAllocator* allocator = nullptr;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  MemoryAllocator::Allocation allocation = {};
+  uint8_t* mapped = nullptr;
+
+  VkDeviceSize alignment = 0;
+  VkDeviceSize frameSize = 0;
+  uint32_t frameCount = 0;
+
+  uint32_t frameIdx = 0;
+  VkDeviceSize head = 0;
+  VkDeviceSize flushed = 0;
+
+  // More than one queue family shares the buffer concurrently between them.
+  UniformRing(VkDevice device,
+              MemoryAllocator* allocator,
+              const VkPhysicalDeviceProperties& props,
+              VkDeviceSize frameSize,
+              uint32_t frameCount,
+              const std::vector<uint32_t>& queueFamilies = {});
+
+  UniformRing(const UniformRing&) = delete;
+  UniformRing& operator=(const UniformRing&) = delete;
+
+  ~UniformRing();
+
+  // Starts writing into the region of frameIdx. The caller guarantees that
+  // the GPU finished reading it, i.e. the frame's fence signalled.
+  void BeginFrame(uint32_t frameIdx);
+
+  uint32_t Push(const void* data, VkDeviceSize size);
+
+  template<typename T>
+  uint32_t Push(const T& value)
+  {
+    return Push(&value, sizeof(T));
+  }
+
+  // Makes everything pushed since the last flush visible to the device. Does
+  // nothing on coherent memory.
+  void Flush();
+
+  VkDescriptorBufferInfo GetDescriptorBufferInfo(VkDeviceSize range) const;
+};
@@ -0,0 +1,399 @@
+#include "upload_manager.h"
+
+#include <algorithm>
+
+#include "cpu_profiler.h"
+#include "vk_init.h"
+#include "vk_utils.h"
+
+static VkDeviceSize
+alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+UploadManager::UploadManager(VkDevice device,
+                             MemoryAllocator* allocator,
+                             uint32_t queueFamilyIdx,
+                             VkQueue queue,
+                             uint32_t dstQueueFamilyIdx,
+                             VkQueue dstQueue,
+                             VkDeviceSize stagingSize)
+  : device(device)
+  , allocator(allocator)
+  , queueFamilyIdx(queueFamilyIdx)
+  , queue(queue)
+  , dstQueueFamilyIdx(dstQueueFamilyIdx)
+  , dstQueue(dstQueue)
+  , ownershipTransfer(queueFamilyIdx != dstQueueFamilyIdx)
+  , capacity(stagingSize)
+{
+  auto poolInfo = vkiCommandPoolCreateInfo(queueFamilyIdx);
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                   VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  ASSERT_VK_SUCCESS(vkCreateCommandPool(device, &poolInfo, nullptr, &cmdPool));
+
+  if (ownershipTransfer) {
+    poolInfo.queueFamilyIndex = dstQueueFamilyIdx;
+    ASSERT_VK_SUCCESS(
+      vkCreateCommandPool(device, &poolInfo, nullptr, &dstCmdPool));
+  }
+
+  stagingBuffer = vkuCreateBuffer(device,
+                                  capacity,
+                                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                  VK_SHARING_MODE_EXCLUSIVE,
+                                  {});
+  ASSERT_VK_VALID_HANDLE(stagingBuffer);
+
+  stagingAllocation = allocator->AllocateForBuffer(
+    stagingBuffer,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  ASSERT_TRUE(stagingAllocation.IsValid());
+
+  staging = static_cast<uint8_t*>(stagingAllocation.mapped);
+}
+
+UploadManager::~UploadManager()
+{
+  Flush();
+
+  for (auto batch : freeBatches) {
+    vkDestroyFence(device, batch->fence, nullptr);
+    vkDestroySemaphore(device, batch->copyFinished, nullptr);
+    delete batch;
+  }
+
+  if (ownershipTransfer) {
+    vkDestroyCommandPool(device, dstCmdPool, nullptr);
+  }
+  vkDestroyCommandPool(device, cmdPool, nullptr);
+  vkDestroyBuffer(device, stagingBuffer, nullptr);
+  allocator->Free(stagingAllocation);
+}
+
+void
+UploadManager::UploadBuffer(VkBuffer buffer,
+                            VkDeviceSize offset,
+                            VkDeviceSize size,
+                            const void* data,
+                            bool concurrent)
+{
+  // Split uploads that do not fit into half the ring, otherwise a single
+  // large buffer could never find contiguous staging space.
+  const VkDeviceSize maxChunk = capacity / 2;
+  const uint8_t* src = static_cast<const uint8_t*>(data);
+
+  while (size > 0) {
+    VkDeviceSize chunk = std::min(size, maxChunk);
+    VkDeviceSize stagingOffset = AllocateStaging(chunk, 16);
+    memcpy(staging + stagingOffset, src, chunk);
+
+    Batch* batch = GetCurrentBatch();
+    VkBufferCopy copyRegion = { stagingOffset, offset, chunk };
+    vkCmdCopyBuffer(batch->cmdBuffer, stagingBuffer, buffer, 1, &copyRegion);
+
+    if (ownershipTransfer && !concurrent) {
+      batch->bufferBarriers.push_back(
+        vkiBufferMemoryBarrier(VK_ACCESS_TRANSFER_WRITE_BIT,
+                               0,
+                               queueFamilyIdx,
+                               dstQueueFamilyIdx,
+                               buffer,
+                               offset,
+                               chunk));
+    }
+
+    src += chunk;
+    offset += chunk;
+    size -= chunk;
+  }
+}
+
+void
+UploadManager::UploadImage(VkImage image,
+                           VkFormat format,
+                           VkExtent3D extent,
+                           VkImageLayout oldLayout,
+                           VkImageLayout newLayout,
+                           VkDeviceSize size,
+                           const void* data)
+{
+  ASSERT_TRUE(size <= capacity);
+
+  // bufferOffset must be a multiple of the texel size and of 4.
+  VkDeviceSize stagingOffset = AllocateStaging(size, 16);
+  memcpy(staging + stagingOffset, data, size);
+
+  Batch* batch = GetCurrentBatch();
+
+  VkImageSubresourceRange imageSubresourceRange =
+    vkiImageSubresourceRange(vkuGetImageAspectFlags(format), 0, 1, 0, 1);
+
+  vkuTransitionLayout(batch->cmdBuffer,
+                      image,
+                      imageSubresourceRange,
+                      oldLayout,
+                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+  auto bufferCopyRegion = vkiBufferImageCopy(
+    stagingOffset,
+    0,
+    0,
+    vkiImageSubresourceLayers(vkuGetImageAspectFlags(format), 0, 0, 1),
+    {},
+    extent);
+
+  vkCmdCopyBufferToImage(batch->cmdBuffer,
+                         stagingBuffer,
+                         image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         1,
+                         &bufferCopyRegion);
+
+  if (!ownershipTransfer) {
+    vkuTransitionLayout(batch->cmdBuffer,
+                        image,
+                        imageSubresourceRange,
+                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                        newLayout);
+    return;
+  }
+
+  // The layout transition is part of the release/acquire pair.
+  batch->imageBarriers.push_back(
+    vkiImageMemoryBarrier(VK_ACCESS_TRANSFER_WRITE_BIT,
+                          0,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          newLayout,
+                          queueFamilyIdx,
+                          dstQueueFamilyIdx,
+                          image,
+                          imageSubresourceRange));
+}
+
+UploadManager::Ticket
+UploadManager::Submit(VkCommandBuffer prologue)
+{
+  if (!current)
+    return nextTicket - 1;
+
+  ASSERT_TRUE(prologue == VK_NULL_HANDLE || !ownershipTransfer);
+
+  Batch* batch = current;
+  current = nullptr;
+  batch->ticket = nextTicket++;
+
+  const VkAccessFlags readAccess =
+    VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+    VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT |
+    VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+
+  if (!ownershipTransfer) {
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = readAccess;
+    vkCmdPipelineBarrier(batch->cmdBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         0,
+                         1,
+                         &barrier,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr);
+
+    ASSERT_VK_SUCCESS(vkEndCommandBuffer(batch->cmdBuffer));
+
+    VkCommandBuffer cmdBuffers[] = { prologue, batch->cmdBuffer };
+    uint32_t cmdBufferCount = prologue != VK_NULL_HANDLE ? 2 : 1;
+    auto submitInfo = vkiSubmitInfo(0,
+                                    nullptr,
+                                    nullptr,
+                                    cmdBufferCount,
+                                    cmdBuffers + 2 - cmdBufferCount,
+                                    0,
+                                    nullptr);
+    ASSERT_VK_SUCCESS(vkQueueSubmit(queue, 1, &submitInfo, batch->fence));
+
+    pending.push_back(batch);
+    return batch->ticket;
+  }
+
+  // Release on the transfer queue.
+  vkCmdPipelineBarrier(batch->cmdBuffer,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                       0,
+                       0,
+                       nullptr,
+                       static_cast<uint32_t>(batch->bufferBarriers.size()),
+                       batch->bufferBarriers.data(),
+                       static_cast<uint32_t>(batch->imageBarriers.size()),
+                       batch->imageBarriers.data());
+  ASSERT_VK_SUCCESS(vkEndCommandBuffer(batch->cmdBuffer));
+
+  auto submitInfo = vkiSubmitInfo(
+    0, nullptr, nullptr, 1, &batch->cmdBuffer, 1, &batch->copyFinished);
+  ASSERT_VK_SUCCESS(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+
+  // Acquire on the destination queue, the same barriers with the access
+  // masks moved to the destination side.
+  for (auto& barrier : batch->bufferBarriers) {
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = readAccess;
+  }
+  for (auto& barrier : batch->imageBarriers) {
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = vkuGetImageAccessFlags(barrier.newLayout) |
+                            VK_ACCESS_SHADER_READ_BIT;
+  }
+
+  vkuBeginCmdBuffer(batch->acquireCmdBuffer,
+                    VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  vkCmdPipelineBarrier(batch->acquireCmdBuffer,
+                       VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                       0,
+                       0,
+                       nullptr,
+                       static_cast<uint32_t>(batch->bufferBarriers.size()),
+                       batch->bufferBarriers.data(),
+                       static_cast<uint32_t>(batch->imageBarriers.size()),
+                       batch->imageBarriers.data());
+  ASSERT_VK_SUCCESS(vkEndCommandBuffer(batch->acquireCmdBuffer));
+
+  VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  auto acquireSubmitInfo = vkiSubmitInfo(1,
+                                         &batch->copyFinished,
+                                         &waitStage,
+                                         1,
+                                         &batch->acquireCmdBuffer,
+                                         0,
+                                         nullptr);
+  ASSERT_VK_SUCCESS(
+    vkQueueSubmit(dstQueue, 1, &acquireSubmitInfo, batch->fence));
+
+  pending.push_back(batch);
+  return batch->ticket;
+}
+
+bool
+UploadManager::IsComplete(Ticket ticket)
+{
+  Collect();
+  return ticket <= completedTicket;
+}
+
+void
+UploadManager::Wait(Ticket ticket)
+{
+  while (ticket > completedTicket && !pending.empty()) {
+    WaitOldest();
+  }
+}
+
+void
+UploadManager::Flush()
+{
+  Wait(Submit());
+}
+
+void
+UploadManager::Collect()
+{
+  while (!pending.empty()) {
+    Batch* batch = pending.front();
+    if (vkGetFenceStatus(device, batch->fence) != VK_SUCCESS)
+      break;
+
+    pending.pop_front();
+    used -= batch->stagingBytes;
+    completedTicket = batch->ticket;
+    freeBatches.push_back(batch);
+  }
+}
+
+UploadManager::Batch*
+UploadManager::GetCurrentBatch()
+{
+  if (current)
+    return current;
+
+  Collect();
+
+  if (freeBatches.empty()) {
+    Batch* batch = new Batch;
+    batch->cmdBuffer =
+      vkuAllocateCmdBuffer(device, cmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+    batch->fence = vkuCreateFence(device);
+    if (ownershipTransfer) {
+      batch->acquireCmdBuffer = vkuAllocateCmdBuffer(
+        device, dstCmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+      auto semaphoreInfo = vkiSemaphoreCreateInfo();
+      ASSERT_VK_SUCCESS(vkCreateSemaphore(
+        device, &semaphoreInfo, nullptr, &batch->copyFinished));
+    }
+    current = batch;
+  } else {
+    current = freeBatches.back();
+    freeBatches.pop_back();
+    ASSERT_VK_SUCCESS(vkResetFences(device, 1, &current->fence));
+    ASSERT_VK_SUCCESS(vkResetCommandBuffer(current->cmdBuffer, 0));
+    if (ownershipTransfer) {
+      ASSERT_VK_SUCCESS(vkResetCommandBuffer(current->acquireCmdBuffer, 0));
+    }
+  }
+
+  current->stagingBytes = 0;
+  current->bufferBarriers.clear();
+  current->imageBarriers.clear();
+  vkuBeginCmdBuffer(current->cmdBuffer,
+                    VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  return current;
+}
+
+void
+UploadManager::WaitOldest()
+{
+  PROFILE_SCOPE("UploadManager::WaitOldest");
+  Batch* batch = pending.front();
+  ASSERT_VK_SUCCESS(
+    vkWaitForFences(device, 1, &batch->fence, VK_TRUE, (uint64_t)-1));
+  Collect();
+}
+
+VkDeviceSize
+UploadManager::AllocateStaging(VkDeviceSize size, VkDeviceSize alignment)
+{
+  ASSERT_TRUE(size <= capacity);
+
+  for (;;) {
+    if (used == 0) {
+      head = 0;
+    }
+
+    // Allocations never wrap, the tail of the ring is skipped instead and
+    // accounted to the batch so it is returned together with it.
+    VkDeviceSize offset = alignUp(head, alignment);
+    VkDeviceSize needed = offset - head + size;
+    if (offset + size > capacity) {
+      offset = 0;
+      needed = capacity - head + size;
+    }
+
+    if (used + needed <= capacity) {
+      GetCurrentBatch()->stagingBytes += needed;
+      used += needed;
+      head = offset + size == capacity ? 0 : offset + size;
+      return offset;
+    }
+
+    // The ring is full. Hand the current batch to the GPU so its space can
+    // be reclaimed, then wait for the oldest batch in flight.
+    Submit();
+    WaitOldest();
+  }
+}
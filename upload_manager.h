@@ -0,0 +1,121 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "memory_allocator.h"
+
+// Batches buffer and image uploads. Data is copied into a persistently mapped
+// staging ring and the copies are recorded into one command buffer per batch.
+// Submit() sends the batch off with a fence and returns a ticket; staging
+// space of a batch is reclaimed once its fence signalled. Nothing blocks
+// unless the ring runs full or the caller waits for a ticket explicitly.
+//
+// Every batch ends with a barrier that makes its writes visible to all later
+// work on the same queue, so geometry uploaded before a frame is submitted
+// can be used by that frame without further synchronization.
+//
+// With a dedicated transfer queue the copies run on that queue and overlap
+// rendering. Every resource is then released by the transfer family at the
+// end of the batch and acquired by the destination family in a small command
+// buffer submitted to the destination queue, which waits on a semaphore
+// signalled by the copy. Uploaded images must not be in use by the
+// destination queue, their previous contents are not transferred back.
+struct UploadManager
+{
+  typedef uint64_t Ticket;
+
+  VkDevice device = VK_NULL_HANDLE;
+  MemoryAllocator* allocator = nullptr;
+  uint32_t queueFamilyIdx = (uint32_t)-1;
+  VkQueue queue = VK_NULL_HANDLE;
+  VkCommandPool cmdPool = VK_NULL_HANDLE;
+
+  // Queue that consumes the uploaded resources.
+  uint32_t dstQueueFamilyIdx = (uint32_t)-1;
+  VkQueue dstQueue = VK_NULL_HANDLE;
+  VkCommandPool dstCmdPool = VK_NULL_HANDLE;
+  bool ownershipTransfer = false;
+
+  UploadManager(VkDevice device,
+                MemoryAllocator* allocator,
+                uint32_t queueFamilyIdx,
+                VkQueue queue,
+                uint32_t dstQueueFamilyIdx,
+                VkQueue dstQueue,
+                VkDeviceSize stagingSize = 32 * 1024 * 1024);
+
+  UploadManager(const UploadManager&) = delete;
+  UploadManager& operator=(const UploadManager&) = delete;
+
+  ~UploadManager();
+
+  // Buffers shared concurrently by the upload family and the destination
+  // family need no ownership transfer, pass concurrent for them.
+  void UploadBuffer(VkBuffer buffer,
+                    VkDeviceSize offset,
+                    VkDeviceSize size,
+                    const void* data,
+                    bool concurrent = false);
+
+  void UploadImage(VkImage image,
+                   VkFormat format,
+                   VkExtent3D extent,
+                   VkImageLayout oldLayout,
+                   VkImageLayout newLayout,
+                   VkDeviceSize size,
+                   const void* data);
+
+  bool HasPendingCopies() const { return current != nullptr; }
+
+  // Submits the recorded copies. Returns the ticket of the last submitted
+  // batch if nothing was recorded since. Without an ownership transfer a
+  // prologue command buffer of the queue's family may be passed, it executes
+  // right before the copies as part of the same submission.
+  Ticket Submit(VkCommandBuffer prologue = VK_NULL_HANDLE);
+
+  bool IsComplete(Ticket ticket);
+  void Wait(Ticket ticket);
+  // Submits pending copies and waits for all of them.
+  void Flush();
+  // Reclaims staging space and command buffers of finished batches.
+  void Collect();
+
+  VkDeviceSize GetStagingUsage() const { return used; }
+
+private:
+  struct Batch
+  {
+    VkCommandBuffer cmdBuffer = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    Ticket ticket = 0;
+    VkDeviceSize stagingBytes = 0;
+
+    // Ownership transfer only.
+    VkCommandBuffer acquireCmdBuffer = VK_NULL_HANDLE;
+    VkSemaphore copyFinished = VK_NULL_HANDLE;
+    std::vector<VkBufferMemoryBarrier> bufferBarriers = {};
+    std::vector<VkImageMemoryBarrier> imageBarriers = {};
+  };
+
+  VkBuffer stagingBuffer = VK_NULL_HANDLE;
+  MemoryAllocator::Allocation stagingAllocation = {};
+  uint8_t* staging = nullptr;
+  VkDeviceSize capacity = 0;
+  VkDeviceSize head = 0;
+  VkDeviceSize used = 0;
+
+  Batch* current = nullptr;
+  std::deque<Batch*> pending = {};
+  std::vector<Batch*> freeBatches = {};
+
+  Ticket nextTicket = 1;
+  Ticket completedTicket = 0;
+
+  Batch* GetCurrentBatch();
+  void WaitOldest();
+  // Returns the offset of size bytes inside the staging ring, waiting for
+  // older batches when the ring is full.
+  VkDeviceSize AllocateStaging(VkDeviceSize size, VkDeviceSize alignment);
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+// Normalized integer attributes, read as floats in [0, 1] by the shader.
+struct Unorm16x4
+{
+  uint16_t v[4];
+};
+
+struct Unorm8x4
+{
+  uint8_t v[4];
+};
+
+// VkFormat of a vertex member type. Unspecialized types do not compile.
+// Matrices take one location per column.
+template<typename T>
+struct VertexAttributeFormat;
+
+#define VERTEX_ATTRIBUTE_FORMAT(type, format)                                  \
+  template<>                                                                   \
+  struct VertexAttributeFormat<type>                                           \
+  {                                                                            \
+    static const VkFormat value = format;                                      \
+    static const uint32_t columns = 1;                                         \
+  }
+
+VERTEX_ATTRIBUTE_FORMAT(float, VK_FORMAT_R32_SFLOAT);
+VERTEX_ATTRIBUTE_FORMAT(glm::vec2, VK_FORMAT_R32G32_SFLOAT);
+VERTEX_ATTRIBUTE_FORMAT(glm::vec3, VK_FORMAT_R32G32B32_SFLOAT);
+VERTEX_ATTRIBUTE_FORMAT(glm::vec4, VK_FORMAT_R32G32B32A32_SFLOAT);
+VERTEX_ATTRIBUTE_FORMAT(Unorm16x4, VK_FORMAT_R16G16B16A16_UNORM);
+VERTEX_ATTRIBUTE_FORMAT(Unorm8x4, VK_FORMAT_R8G8B8A8_UNORM);
+
+#undef VERTEX_ATTRIBUTE_FORMAT
+
+template<>
+struct VertexAttributeFormat<glm::mat4>
+{
+  static const VkFormat value = VK_FORMAT_R32G32B32A32_SFLOAT;
+  static const uint32_t columns = 4;
+};
+
+// Builds the input descriptions of a vertex struct from its members, in
+// shader location order:
+//
+//   VertexLayout<Vertex>(0).Add(&Vertex::pos).Add(&Vertex::color)
+template<typename Vertex>
+struct VertexLayout
+{
+  VkVertexInputBindingDescription binding = {};
+  std::vector<VkVertexInputAttributeDescription> attributes = {};
+
+  explicit VertexLayout(
+    uint32_t binding,
+    VkVertexInputRate inputRate = VK_VERTEX_INPUT_RATE_VERTEX)
+  {
+    this->binding.binding = binding;
+    this->binding.stride = sizeof(Vertex);
+    this->binding.inputRate = inputRate;
+  }
+
+  // Takes the location after the previous attribute.
+  template<typename T>
+  VertexLayout& Add(T Vertex::*member)
+  {
+    uint32_t location =
+      attributes.empty() ? 0 : attributes.back().location + 1;
+    return Add(member, location);
+  }
+
+  template<typename T>
+  VertexLayout& Add(T Vertex::*member, uint32_t location)
+  {
+    // offsetof for member pointers, Vertex must be default constructible.
+    Vertex vertex;
+    uint32_t offset = static_cast<uint32_t>(
+      reinterpret_cast<const char*>(&(vertex.*member)) -
+      reinterpret_cast<const char*>(&vertex));
+
+    const uint32_t columns = VertexAttributeFormat<T>::columns;
+    for (uint32_t i = 0; i < columns; ++i) {
+      VkVertexInputAttributeDescription attribute = {};
+      attribute.binding = binding.binding;
+      attribute.location = location + i;
+      attribute.format = VertexAttributeFormat<T>::value;
+      attribute.offset = offset + i * (sizeof(T) / columns);
+      attributes.push_back(attribute);
+    }
+    return *this;
+  }
+};
+
+// Maps positions inside a bounding box to [0, 1] for unorm storage. The
+// shader reverses it with position * scale + bias.
+struct PositionQuantization
+{
+  glm::vec3 scale = glm::vec3(1.0f);
+  glm::vec3 bias = glm::vec3(0.0f);
+
+  PositionQuantization() = default;
+  PositionQuantization(glm::vec3 min, glm::vec3 max)
+    : scale(max - min)
+    , bias(min)
+  {}
+
+  Unorm16x4 Quantize(glm::vec3 position) const
+  {
+    Unorm16x4 result = { { 0, 0, 0, 0 } };
+    for (int i = 0; i < 3; ++i) {
+      // Flat axes keep the bias alone.
+      float t = scale[i] > 0.0f ? (position[i] - bias[i]) / scale[i] : 0.0f;
+      t = t < 0.0f ? 0.0f : t > 1.0f ? 1.0f : t;
+      result.v[i] = static_cast<uint16_t>(std::lround(t * 65535.0f));
+    }
+    return result;
+  }
+};
+
+inline Unorm8x4
+PackColor(glm::vec4 color)
+{
+  Unorm8x4 result;
+  for (int i = 0; i < 4; ++i) {
+    float c = color[i] < 0.0f ? 0.0f : color[i] > 1.0f ? 1.0f : color[i];
+    result.v[i] = static_cast<uint8_t>(std::lround(c * 255.0f));
+  }
+  return result;
+}
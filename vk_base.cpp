@@ -1,28 +1,70 @@
 #include "vk_base.h"
 
 #include <algorithm>
+#include <cstring>
 
+#include "cpu_profiler.h"
 #include "vk_init.h"
 #include "vk_utils.h"
 
-VulkanBase::VulkanBase(VulkanWindow* window)
+static bool
+hasInstanceLayer(const char* name)
+{
+  uint32_t count = 0;
+  vkEnumerateInstanceLayerProperties(&count, nullptr);
+  std::vector<VkLayerProperties> layers(count);
+  vkEnumerateInstanceLayerProperties(&count, layers.data());
+
+  for (const auto& layer : layers) {
+    if (strcmp(layer.layerName, name) == 0)
+      return true;
+  }
+  return false;
+}
+
+static bool
+hasInstanceExtension(const char* name)
+{
+  uint32_t count = 0;
+  vkEnumerateInstanceExtensionProperties(nullptr, &count, nullptr);
+  std::vector<VkExtensionProperties> extensions(count);
+  vkEnumerateInstanceExtensionProperties(nullptr, &count, extensions.data());
+
+  for (const auto& extension : extensions) {
+    if (strcmp(extension.extensionName, name) == 0)
+      return true;
+  }
+  return false;
+}
+
+VulkanBase::VulkanBase(VulkanWindow* window, Settings settings)
   : window(window)
+  , settings(settings)
+  , framesInFlight(settings.framesInFlight)
 {
+  ASSERT_TRUE(framesInFlight > 0);
   CreateSwapchainIndependentResources();
-  swapchain = new Swapchain(device, physicalDeviceProps, surface);
+  CreateFrames();
+  swapchain = CreateSwapchain();
   CreateSwapchainDependentResources();
 }
 
 VulkanBase::~VulkanBase()
 {
+  vkDeviceWaitIdle(device);
   DestroySwapchainDependentResources();
   delete swapchain;
+  DestroyFrames();
   DestroySwapchainIndependentResources();
 }
 
 void
 VulkanBase::Update()
 {
+  // Offscreen images keep their size.
+  if (IsHeadless())
+    return;
+
   auto windowExtent = window->GetExtent();
 
   if (windowExtent.width != swapchain->imageExtent.width ||
@@ -31,13 +73,204 @@ VulkanBase::Update()
   }
 }
 
+VulkanBase::Frame&
+VulkanBase::BeginFrame()
+{
+  PROFILE_SCOPE("Wait for frame fence");
+  Frame& frame = frames[frameIdx];
+  ASSERT_VK_SUCCESS(
+    vkWaitForFences(device, 1, &frame.fence, VK_TRUE, (uint64_t)-1));
+  if (settings.resetCommandPools) {
+    PROFILE_SCOPE("vkResetCommandPool");
+    ASSERT_VK_SUCCESS(vkResetCommandPool(device, frame.commandPool, 0));
+  }
+  if (frame.computeCommandPool != VK_NULL_HANDLE) {
+    ASSERT_VK_SUCCESS(vkResetCommandPool(device, frame.computeCommandPool, 0));
+  }
+  recorder->BeginFrame(frameIdx);
+  return frame;
+}
+
+void
+VulkanBase::WaitForImage(uint32_t imageIdx)
+{
+  Frame& frame = frames[frameIdx];
+  VkFence imageFence = imageFences[imageIdx];
+
+  if (imageFence != VK_NULL_HANDLE && imageFence != frame.fence) {
+    PROFILE_SCOPE("Wait for image fence");
+    ASSERT_VK_SUCCESS(
+      vkWaitForFences(device, 1, &imageFence, VK_TRUE, (uint64_t)-1));
+  }
+
+  imageFences[imageIdx] = frame.fence;
+  ASSERT_VK_SUCCESS(vkResetFences(device, 1, &frame.fence));
+}
+
+void
+VulkanBase::EndFrame()
+{
+  frameIdx = (frameIdx + 1) % framesInFlight;
+}
+
+void
+VulkanBase::ResetFrameCommandBuffer(VkCommandBuffer cmd)
+{
+  if (!settings.resetCommandPools) {
+    ASSERT_VK_SUCCESS(vkResetCommandBuffer(cmd, 0));
+  }
+}
+
+uint32_t
+VulkanBase::AcquireNextImage(const Frame& frame)
+{
+  if (IsHeadless()) {
+    uint32_t imageIdx = headlessImageIdx;
+    headlessImageIdx = (headlessImageIdx + 1) % swapchain->imageCount;
+    return imageIdx;
+  }
+
+  PROFILE_SCOPE("vkAcquireNextImageKHR");
+  uint32_t imageIdx = -1;
+  ASSERT_VK_SUCCESS(vkAcquireNextImageKHR(device,
+                                          swapchain->handle,
+                                          UINT64_MAX,
+                                          frame.imageAvailableSemaphore,
+                                          VK_NULL_HANDLE,
+                                          &imageIdx));
+  return imageIdx;
+}
+
+void
+VulkanBase::Present(const Frame& frame, uint32_t imageIdx)
+{
+  presentedImageIdx = imageIdx;
+
+  if (IsHeadless())
+    return;
+
+  PROFILE_SCOPE("vkQueuePresentKHR");
+  VkPresentInfoKHR presentInfo =
+    vkiPresentInfoKHR(1,
+                      &frame.renderFinishedSemaphore,
+                      1,
+                      &swapchain->handle,
+                      &imageIdx,
+                      nullptr);
+  ASSERT_VK_SUCCESS(vkQueuePresentKHR(queue, &presentInfo));
+}
+
+std::vector<uint8_t>
+VulkanBase::ReadbackImage(uint32_t imageIdx)
+{
+  PROFILE_SCOPE("VulkanBase::ReadbackImage");
+  ASSERT_TRUE(IsHeadless());
+  ASSERT_TRUE(imageIdx < swapchain->imageCount);
+  // The image is in TRANSFER_SRC_OPTIMAL only after a frame rendered into it.
+  ASSERT_TRUE(imageFences[imageIdx] != VK_NULL_HANDLE);
+
+  VkExtent2D extent = swapchain->imageExtent;
+  // Offscreen images are always VK_FORMAT_B8G8R8A8_UNORM.
+  VkDeviceSize size = VkDeviceSize(extent.width) * extent.height * 4;
+
+  VkBuffer buffer = vkuCreateBuffer(device,
+                                    size,
+                                    VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                    VK_SHARING_MODE_EXCLUSIVE,
+                                    {});
+  MemoryAllocator::Allocation allocation = allocator->AllocateForBuffer(
+    buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+  ASSERT_TRUE(allocation.IsValid());
+
+  VkCommandBuffer cmd = VK_NULL_HANDLE;
+  VkCommandBufferAllocateInfo allocateInfo =
+    vkiCommandBufferAllocateInfo(cmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+  ASSERT_VK_SUCCESS(vkAllocateCommandBuffers(device, &allocateInfo, &cmd));
+
+  VkCommandBufferBeginInfo beginInfo = vkiCommandBufferBeginInfo(nullptr);
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  ASSERT_VK_SUCCESS(vkBeginCommandBuffer(cmd, &beginInfo));
+
+  // Same queue as the frames, the barrier orders the copy after the render
+  // pass that last wrote the image.
+  VkImageMemoryBarrier imageBarrier =
+    vkiImageMemoryBarrier(VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                          VK_ACCESS_TRANSFER_READ_BIT,
+                          VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                          VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                          VK_QUEUE_FAMILY_IGNORED,
+                          VK_QUEUE_FAMILY_IGNORED,
+                          swapchain->images[imageIdx],
+                          { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+  vkCmdPipelineBarrier(cmd,
+                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       0,
+                       0,
+                       nullptr,
+                       0,
+                       nullptr,
+                       1,
+                       &imageBarrier);
+
+  VkBufferImageCopy region =
+    vkiBufferImageCopy(0,
+                       0,
+                       0,
+                       { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+                       { 0, 0, 0 },
+                       { extent.width, extent.height, 1 });
+  vkCmdCopyImageToBuffer(cmd,
+                         swapchain->images[imageIdx],
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                         buffer,
+                         1,
+                         &region);
+
+  VkMemoryBarrier hostBarrier =
+    vkiMemoryBarrier(VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT);
+  vkCmdPipelineBarrier(cmd,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT,
+                       0,
+                       1,
+                       &hostBarrier,
+                       0,
+                       nullptr,
+                       0,
+                       nullptr);
+  ASSERT_VK_SUCCESS(vkEndCommandBuffer(cmd));
+
+  VkFence fence = VK_NULL_HANDLE;
+  VkFenceCreateInfo fenceInfo = vkiFenceCreateInfo();
+  ASSERT_VK_SUCCESS(vkCreateFence(device, &fenceInfo, nullptr, &fence));
+
+  VkSubmitInfo submitInfo =
+    vkiSubmitInfo(0, nullptr, nullptr, 1, &cmd, 0, nullptr);
+  ASSERT_VK_SUCCESS(vkQueueSubmit(queue, 1, &submitInfo, fence));
+  ASSERT_VK_SUCCESS(
+    vkWaitForFences(device, 1, &fence, VK_TRUE, (uint64_t)-1));
+
+  allocator->Invalidate(allocation);
+  const uint8_t* data = static_cast<const uint8_t*>(allocation.mapped);
+  std::vector<uint8_t> pixels(data, data + size);
+
+  vkDestroyFence(device, fence, nullptr);
+  vkFreeCommandBuffers(device, cmdPool, 1, &cmd);
+  vkDestroyBuffer(device, buffer, nullptr);
+  allocator->Free(allocation);
+
+  return pixels;
+}
+
 void
 VulkanBase::ReinitSwapchain()
 {
+  PROFILE_SCOPE("VulkanBase::ReinitSwapchain");
   vkDeviceWaitIdle(device);
 
   delete swapchain;
-  swapchain = new Swapchain(device, physicalDeviceProps, surface);
+  swapchain = CreateSwapchain();
 
   DestroySwapchainDependentResources();
   CreateSwapchainDependentResources();
@@ -45,14 +278,38 @@ VulkanBase::ReinitSwapchain()
   OnSwapchainReinitialized();
 }
 
+VulkanBase::Swapchain*
+VulkanBase::CreateSwapchain()
+{
+  if (IsHeadless()) {
+    return new Swapchain(device,
+                         allocator,
+                         settings.headlessExtent,
+                         settings.headlessImageCount);
+  }
+  return new Swapchain(device, physicalDeviceProps, surface);
+}
+
 void
 VulkanBase::CreateSwapchainIndependentResources()
 {
-  // Instance
-  instanceLayers.push_back("VK_LAYER_LUNARG_standard_validation");
-  instanceExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
-  instanceExtensions.push_back("VK_KHR_win32_surface");
-  instanceExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+  // Instance, layers and debug extensions are optional, CI machines and
+  // software implementations usually come without them.
+  if (settings.validation) {
+    if (hasInstanceLayer("VK_LAYER_KHRONOS_validation")) {
+      instanceLayers.push_back("VK_LAYER_KHRONOS_validation");
+    } else if (hasInstanceLayer("VK_LAYER_LUNARG_standard_validation")) {
+      instanceLayers.push_back("VK_LAYER_LUNARG_standard_validation");
+    }
+  }
+
+  if (!IsHeadless()) {
+    instanceExtensions = window->GetInstanceExtensions();
+  }
+
+  if (hasInstanceExtension(VK_EXT_DEBUG_REPORT_EXTENSION_NAME)) {
+    instanceExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+  }
 
   VkApplicationInfo appInfo =
     vkiApplicationInfo(nullptr, 0, nullptr, 0, VK_API_VERSION_1_0);
@@ -67,10 +324,14 @@ VulkanBase::CreateSwapchainIndependentResources()
   ASSERT_VK_SUCCESS(vkCreateInstance(&instInfo, nullptr, &instance));
 
   // Surface
-  surface = window->CreateSurface(instance);
+  if (!IsHeadless()) {
+    surface = window->CreateSurface(instance);
+  }
 
   // Device
-  deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  if (!IsHeadless()) {
+    deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  }
 
   uint32_t physicalDeviceCount = 0;
   vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, nullptr);
@@ -81,29 +342,66 @@ VulkanBase::CreateSwapchainIndependentResources()
   for (const auto& dev : physicalsDevices) {
     physicalDeviceProps = PhysicalDeviceProps(dev, surface);
     if (physicalDeviceProps.HasGraphicsSupport() &&
-        physicalDeviceProps.HasPresentSupport()) {
+        (IsHeadless() || physicalDeviceProps.HasPresentSupport())) {
       break;
     }
   }
 
   ASSERT_VK_VALID_HANDLE(physicalDeviceProps.handle);
-  ASSERT_TRUE(physicalDeviceProps.GetGrahicsQueueFamiliyIdx() ==
-              physicalDeviceProps.GetPresentQueueFamiliyIdx());
+  ASSERT_TRUE(IsHeadless() ||
+              physicalDeviceProps.GetGrahicsQueueFamiliyIdx() ==
+                physicalDeviceProps.GetPresentQueueFamiliyIdx());
+
+  float queuePriorities[] = { 1.0f, 1.0f };
+  queueFamiliyIdx = physicalDeviceProps.GetGrahicsQueueFamiliyIdx();
+  transferQueueFamiliyIdx = queueFamiliyIdx;
+  computeQueueFamiliyIdx = queueFamiliyIdx;
+
+  if (settings.dedicatedTransferQueue &&
+      physicalDeviceProps.GetTransferQueueFamiliyIdx() != (uint32_t)-1) {
+    transferQueueFamiliyIdx = physicalDeviceProps.GetTransferQueueFamiliyIdx();
+  }
+
+  // Index of the compute queue within its family.
+  uint32_t computeQueueIdx = 0;
+  if (settings.asyncCompute) {
+    if (physicalDeviceProps.GetComputeQueueFamiliyIdx() != (uint32_t)-1) {
+      computeQueueFamiliyIdx = physicalDeviceProps.GetComputeQueueFamiliyIdx();
+    } else if (physicalDeviceProps.queueFamilyProps[queueFamiliyIdx]
+                 .queueCount > 1) {
+      computeQueueIdx = 1;
+    }
+  }
 
-  float queuePriority = 1.0f;
-  uint32_t queueFamiliyIdx = physicalDeviceProps.GetGrahicsQueueFamiliyIdx();
+  std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+  queueCreateInfos.push_back(vkiDeviceQueueCreateInfo(
+    queueFamiliyIdx, computeQueueIdx + 1, queuePriorities));
 
-  VkDeviceQueueCreateInfo queueCreateInfo =
-    vkiDeviceQueueCreateInfo(queueFamiliyIdx, 1, &queuePriority);
+  if (transferQueueFamiliyIdx != queueFamiliyIdx) {
+    queueCreateInfos.push_back(
+      vkiDeviceQueueCreateInfo(transferQueueFamiliyIdx, 1, queuePriorities));
+  }
+
+  if (computeQueueFamiliyIdx != queueFamiliyIdx) {
+    queueCreateInfos.push_back(
+      vkiDeviceQueueCreateInfo(computeQueueFamiliyIdx, 1, queuePriorities));
+  }
 
-  VkPhysicalDeviceFeatures deviceFeatures = {};
-  deviceFeatures.textureCompressionBC = true;
-  deviceFeatures.fillModeNonSolid = true;
-  deviceFeatures.multiDrawIndirect = true;
+  // Request only what the device has, software rasterizers lack some of it.
+  const VkPhysicalDeviceFeatures& supported = physicalDeviceProps.features;
+  VkPhysicalDeviceFeatures& deviceFeatures = enabledFeatures;
+  deviceFeatures = {};
+  deviceFeatures.textureCompressionBC = supported.textureCompressionBC;
+  deviceFeatures.fillModeNonSolid = supported.fillModeNonSolid;
+  deviceFeatures.multiDrawIndirect = supported.multiDrawIndirect;
+  deviceFeatures.drawIndirectFirstInstance =
+    supported.drawIndirectFirstInstance;
+  deviceFeatures.pipelineStatisticsQuery =
+    settings.gpuProfiling && supported.pipelineStatisticsQuery;
 
   VkDeviceCreateInfo deviceCreateInfo =
-    vkiDeviceCreateInfo(1,
-                        &queueCreateInfo,
+    vkiDeviceCreateInfo(static_cast<uint32_t>(queueCreateInfos.size()),
+                        queueCreateInfos.data(),
                         0,
                         nullptr,
                         static_cast<uint32_t>(deviceExtensions.size()),
@@ -115,6 +413,12 @@ VulkanBase::CreateSwapchainIndependentResources()
 
   // Queue
   vkGetDeviceQueue(device, queueFamiliyIdx, 0, &queue);
+  vkGetDeviceQueue(device, transferQueueFamiliyIdx, 0, &transferQueue);
+  vkGetDeviceQueue(
+    device, computeQueueFamiliyIdx, computeQueueIdx, &computeQueue);
+
+  allocator = new MemoryAllocator(
+    device, physicalDeviceProps.props, physicalDeviceProps.memProps);
 
   // CommandPool
   VkCommandPoolCreateInfo commandPoolCreateInfo =
@@ -125,27 +429,125 @@ VulkanBase::CreateSwapchainIndependentResources()
   ASSERT_VK_SUCCESS(
     vkCreateCommandPool(device, &commandPoolCreateInfo, nullptr, &cmdPool));
 
-  // Semaphores
-  VkSemaphoreCreateInfo semaphoreCreateInfo = vkiSemaphoreCreateInfo();
-
-  ASSERT_VK_SUCCESS(vkCreateSemaphore(
-    device, &semaphoreCreateInfo, nullptr, &imageAvailableSemaphore));
-
-  ASSERT_VK_SUCCESS(vkCreateSemaphore(
-    device, &semaphoreCreateInfo, nullptr, &renderFinishedSemaphore));
+  uploader = new UploadManager(device,
+                               allocator,
+                               transferQueueFamiliyIdx,
+                               transferQueue,
+                               queueFamiliyIdx,
+                               queue);
+
+  pipelineCache = new PipelineCache(
+    device, physicalDeviceProps.props, "pipeline_cache.bin");
+  pipelineObjectCache = new PipelineObjectCache;
+  threadPool = new ThreadPool;
+
+  uint32_t timestampValidBits =
+    settings.gpuProfiling
+      ? physicalDeviceProps.queueFamilyProps[queueFamiliyIdx].timestampValidBits
+      : 0;
+  gpuProfiler = new GpuProfiler(device,
+                                physicalDeviceProps.props,
+                                deviceFeatures.pipelineStatisticsQuery,
+                                timestampValidBits,
+                                framesInFlight);
+  recorder = new CommandRecorder(device,
+                                 queueFamiliyIdx,
+                                 framesInFlight,
+                                 threadPool,
+                                 settings.recordThreads);
 }
 
 void
 VulkanBase::DestroySwapchainIndependentResources()
 {
-  vkDestroySemaphore(device, renderFinishedSemaphore, nullptr);
-  vkDestroySemaphore(device, imageAvailableSemaphore, nullptr);
+  // Joins the workers, nothing may still compile when the caches go away.
+  delete threadPool;
+  delete gpuProfiler;
+  delete recorder;
+  delete pipelineObjectCache;
+  delete pipelineCache;
+  delete uploader;
   vkDestroyCommandPool(device, cmdPool, nullptr);
+  delete allocator;
   vkDestroyDevice(device, nullptr);
-  vkDestroySurfaceKHR(instance, surface, nullptr);
+  if (surface != VK_NULL_HANDLE) {
+    vkDestroySurfaceKHR(instance, surface, nullptr);
+  }
   vkDestroyInstance(instance, nullptr);
 }
 
+void
+VulkanBase::CreateFrames()
+{
+  frames.resize(framesInFlight);
+
+  VkSemaphoreCreateInfo semaphoreCreateInfo = vkiSemaphoreCreateInfo();
+
+  // Fences start signalled, the first wait on every slot returns immediately.
+  VkFenceCreateInfo fenceInfo = vkiFenceCreateInfo();
+  fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+  VkCommandPoolCreateInfo poolInfo = vkiCommandPoolCreateInfo(queueFamiliyIdx);
+  poolInfo.flags = settings.resetCommandPools
+                     ? VK_COMMAND_POOL_CREATE_TRANSIENT_BIT
+                     : VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+  for (uint32_t i = 0; i < framesInFlight; ++i) {
+    Frame& frame = frames[i];
+
+    ASSERT_VK_SUCCESS(
+      vkCreateCommandPool(device, &poolInfo, nullptr, &frame.commandPool));
+
+    // Main and prologue command buffer.
+    VkCommandBuffer commandBuffers[2];
+    VkCommandBufferAllocateInfo allocateInfo = vkiCommandBufferAllocateInfo(
+      frame.commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 2);
+    ASSERT_VK_SUCCESS(
+      vkAllocateCommandBuffers(device, &allocateInfo, commandBuffers));
+    frame.commandBuffer = commandBuffers[0];
+    frame.prologueCommandBuffer = commandBuffers[1];
+
+    ASSERT_VK_SUCCESS(vkCreateSemaphore(
+      device, &semaphoreCreateInfo, nullptr, &frame.imageAvailableSemaphore));
+    ASSERT_VK_SUCCESS(vkCreateSemaphore(
+      device, &semaphoreCreateInfo, nullptr, &frame.renderFinishedSemaphore));
+    ASSERT_VK_SUCCESS(vkCreateFence(device, &fenceInfo, nullptr, &frame.fence));
+
+    if (!HasAsyncCompute())
+      continue;
+
+    // Recorded every frame, reset with the pool by BeginFrame.
+    auto computePoolInfo = vkiCommandPoolCreateInfo(computeQueueFamiliyIdx);
+    computePoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    ASSERT_VK_SUCCESS(vkCreateCommandPool(
+      device, &computePoolInfo, nullptr, &frame.computeCommandPool));
+
+    auto computeAllocateInfo = vkiCommandBufferAllocateInfo(
+      frame.computeCommandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+    ASSERT_VK_SUCCESS(vkAllocateCommandBuffers(
+      device, &computeAllocateInfo, &frame.computeCommandBuffer));
+    ASSERT_VK_SUCCESS(vkCreateSemaphore(
+      device, &semaphoreCreateInfo, nullptr, &frame.computeFinishedSemaphore));
+  }
+
+  frameIdx = 0;
+}
+
+void
+VulkanBase::DestroyFrames()
+{
+  for (auto& frame : frames) {
+    // Frees the slot's command buffers.
+    vkDestroyCommandPool(device, frame.commandPool, nullptr);
+    vkDestroyCommandPool(device, frame.computeCommandPool, nullptr);
+    vkDestroySemaphore(device, frame.computeFinishedSemaphore, nullptr);
+    vkDestroyFence(device, frame.fence, nullptr);
+    vkDestroySemaphore(device, frame.renderFinishedSemaphore, nullptr);
+    vkDestroySemaphore(device, frame.imageAvailableSemaphore, nullptr);
+  }
+  frames.clear();
+}
+
 void
 VulkanBase::CreateSwapchainDependentResources()
 {
@@ -166,8 +568,9 @@ VulkanBase::CreateSwapchainDependentResources()
 
   ASSERT_VK_SUCCESS(vkCreateImage(device, &imageInfo, nullptr, &depthImage));
 
-  depthImageMemory = vkuAllocateImageMemory(
-    device, physicalDeviceProps.memProps, depthImage, true);
+  depthImageAllocation = allocator->AllocateForImage(
+    depthImage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  ASSERT_TRUE(depthImageAllocation.IsValid());
   VkImageSubresourceRange range = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
   VkImageViewCreateInfo imageViewInfo =
     vkiImageViewCreateInfo(depthImage,
@@ -182,8 +585,11 @@ VulkanBase::CreateSwapchainDependentResources()
   ASSERT_VK_SUCCESS(
     vkCreateImageView(device, &imageViewInfo, nullptr, &depthImageView));
 
-  // Renderpass
+  // Renderpass, offscreen images are left ready to be copied from.
   std::vector<VkAttachmentDescription> attachmentDescriptions;
+  VkImageLayout colorFinalLayout = IsHeadless()
+                                     ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                     : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
   VkAttachmentDescription colorBufferAttachmentDescription =
     vkiAttachmentDescription(swapchain->surfaceFormat.format,
@@ -193,7 +599,7 @@ VulkanBase::CreateSwapchainDependentResources()
                              VK_ATTACHMENT_LOAD_OP_DONT_CARE,
                              VK_ATTACHMENT_STORE_OP_DONT_CARE,
                              VK_IMAGE_LAYOUT_UNDEFINED,
-                             VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+                             colorFinalLayout);
 
   attachmentDescriptions.push_back(colorBufferAttachmentDescription);
 
@@ -264,45 +670,21 @@ VulkanBase::CreateSwapchainDependentResources()
       vkCreateFramebuffer(device, &createInfo, nullptr, &framebuffers[i]));
   }
 
-  // CommandBuffers
-  commandBuffers.resize(swapchain->imageCount);
-  VkCommandBufferAllocateInfo allocateInfo = vkiCommandBufferAllocateInfo(
-    cmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, swapchain->imageCount);
-
-  ASSERT_VK_SUCCESS(
-    vkAllocateCommandBuffers(device, &allocateInfo, commandBuffers.data()));
-
-  // Fences
-  VkFenceCreateInfo fenceInfo = vkiFenceCreateInfo();
-  fences.resize(swapchain->imageCount);
-  for (size_t i = 0; i < fences.size(); ++i) {
-    ASSERT_VK_SUCCESS(vkCreateFence(device, &fenceInfo, nullptr, &fences[i]));
-
-    // Put fences in a signalled state.
-    VkSubmitInfo submitInfo =
-      vkiSubmitInfo(0, nullptr, 0, 0, nullptr, 0, nullptr);
-
-    ASSERT_VK_SUCCESS(vkQueueSubmit(queue, 1, &submitInfo, fences[i]));
-  }
+  // The swapchain is recreated after vkDeviceWaitIdle, no image is in use.
+  imageFences.assign(swapchain->imageCount, VK_NULL_HANDLE);
 }
 
 void
 VulkanBase::DestroySwapchainDependentResources()
 {
-  for (auto fence : fences) {
-    vkDestroyFence(device, fence, nullptr);
-  }
-  vkFreeCommandBuffers(device,
-                       cmdPool,
-                       static_cast<uint32_t>(commandBuffers.size()),
-                       commandBuffers.data());
+  imageFences.clear();
   for (auto fb : framebuffers) {
     vkDestroyFramebuffer(device, fb, nullptr);
   }
   vkDestroyRenderPass(device, renderPass, nullptr);
   vkDestroyImageView(device, depthImageView, nullptr);
   vkDestroyImage(device, depthImage, nullptr);
-  vkFreeMemory(device, depthImageMemory, nullptr);
+  allocator->Free(depthImageAllocation);
 }
 
 VulkanBase::Swapchain::Swapchain(VkDevice device,
@@ -382,12 +764,76 @@ VulkanBase::Swapchain::Swapchain(VkDevice device,
   }
 }
 
+VulkanBase::Swapchain::Swapchain(VkDevice device,
+                                 MemoryAllocator* allocator,
+                                 VkExtent2D extent,
+                                 uint32_t imageCount)
+  : device(device)
+  , imageExtent(extent)
+  , imageCount(imageCount)
+  , allocator(allocator)
+{
+  ASSERT_TRUE(imageCount > 0);
+
+  surfaceFormat = { VK_FORMAT_B8G8R8A8_UNORM,
+                    VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+  presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+
+  images.resize(imageCount);
+  imageAllocations.resize(imageCount);
+  imageViews.resize(imageCount);
+
+  for (uint32_t i = 0; i < imageCount; ++i) {
+    VkImageCreateInfo imageInfo = vkiImageCreateInfo(
+      VK_IMAGE_TYPE_2D,
+      surfaceFormat.format,
+      { imageExtent.width, imageExtent.height, 1 },
+      1,
+      1,
+      VK_SAMPLE_COUNT_1_BIT,
+      VK_IMAGE_TILING_OPTIMAL,
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      VK_SHARING_MODE_EXCLUSIVE,
+      VK_QUEUE_FAMILY_IGNORED,
+      nullptr,
+      VK_IMAGE_LAYOUT_UNDEFINED);
+
+    ASSERT_VK_SUCCESS(vkCreateImage(device, &imageInfo, nullptr, &images[i]));
+
+    imageAllocations[i] = allocator->AllocateForImage(
+      images[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    ASSERT_TRUE(imageAllocations[i].IsValid());
+
+    auto imageViewCreateInfo =
+      vkiImageViewCreateInfo(images[i],
+                             VK_IMAGE_VIEW_TYPE_2D,
+                             surfaceFormat.format,
+                             { VK_COMPONENT_SWIZZLE_IDENTITY,
+                               VK_COMPONENT_SWIZZLE_IDENTITY,
+                               VK_COMPONENT_SWIZZLE_IDENTITY,
+                               VK_COMPONENT_SWIZZLE_IDENTITY },
+                             { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+
+    ASSERT_VK_SUCCESS(
+      vkCreateImageView(device, &imageViewCreateInfo, nullptr, &imageViews[i]));
+  }
+}
+
 VulkanBase::Swapchain::~Swapchain()
 {
   for (auto imageView : imageViews) {
     vkDestroyImageView(device, imageView, nullptr);
   }
 
+  // Offscreen images are ours, swapchain images belong to the swapchain.
+  if (handle == VK_NULL_HANDLE) {
+    for (uint32_t i = 0; i < images.size(); ++i) {
+      vkDestroyImage(device, images[i], nullptr);
+      allocator->Free(imageAllocations[i]);
+    }
+    return;
+  }
+
   vkDestroySwapchainKHR(device, handle, nullptr);
 }
 
@@ -407,6 +853,10 @@ VulkanBase::PhysicalDeviceProps::PhysicalDeviceProps(
   vkGetPhysicalDeviceQueueFamilyProperties(
     handle, &count, queueFamilyProps.data());
 
+  // Headless, there is nothing to present to.
+  if (surface == VK_NULL_HANDLE)
+    return;
+
   count = 0;
   vkGetPhysicalDeviceSurfaceFormatsKHR(handle, surface, &count, nullptr);
   surfaceFormats.resize(count);
@@ -423,10 +873,14 @@ VulkanBase::PhysicalDeviceProps::PhysicalDeviceProps(
 uint32_t
 VulkanBase::PhysicalDeviceProps::GetGrahicsQueueFamiliyIdx()
 {
+  // Frames record compute passes too, so look for a family supporting both.
+  // The spec guarantees one exists when the device supports graphics at all:
+  // it requires some graphics family to also support compute.
+  const VkQueueFlags flags = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
   for (uint32_t idx = 0; idx < queueFamilyProps.size(); ++idx) {
     if (queueFamilyProps[idx].queueCount == 0)
       continue;
-    if (queueFamilyProps[idx].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+    if ((queueFamilyProps[idx].queueFlags & flags) == flags)
       return idx;
   }
   return -1;
@@ -435,6 +889,9 @@ VulkanBase::PhysicalDeviceProps::GetGrahicsQueueFamiliyIdx()
 uint32_t
 VulkanBase::PhysicalDeviceProps::GetPresentQueueFamiliyIdx()
 {
+  if (surface == VK_NULL_HANDLE)
+    return -1;
+
   for (uint32_t idx = 0; idx < queueFamilyProps.size(); ++idx) {
     if (queueFamilyProps[idx].queueCount == 0)
       continue;
@@ -446,6 +903,33 @@ VulkanBase::PhysicalDeviceProps::GetPresentQueueFamiliyIdx()
   return -1;
 }
 
+uint32_t
+VulkanBase::PhysicalDeviceProps::GetTransferQueueFamiliyIdx()
+{
+  for (uint32_t idx = 0; idx < queueFamilyProps.size(); ++idx) {
+    if (queueFamilyProps[idx].queueCount == 0)
+      continue;
+    VkQueueFlags flags = queueFamilyProps[idx].queueFlags;
+    if ((flags & VK_QUEUE_TRANSFER_BIT) &&
+        !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+      return idx;
+  }
+  return -1;
+}
+
+uint32_t
+VulkanBase::PhysicalDeviceProps::GetComputeQueueFamiliyIdx()
+{
+  for (uint32_t idx = 0; idx < queueFamilyProps.size(); ++idx) {
+    if (queueFamilyProps[idx].queueCount == 0)
+      continue;
+    VkQueueFlags flags = queueFamilyProps[idx].queueFlags;
+    if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+      return idx;
+  }
+  return -1;
+}
+
 VkSurfaceCapabilitiesKHR
 VulkanBase::PhysicalDeviceProps::GetSurfaceCapabilities()
 {
@@ -1,21 +1,82 @@
 #pragma once
 
 // clang-format off
-#include <vulkan\vulkan.h>
-#include <GLFW\glfw3.h>
+#include <vulkan/vulkan.h>
+#include <GLFW/glfw3.h>
 // clang-format on
 
 #include <vector>
 
+#include "command_recorder.h"
+#include "gpu_profiler.h"
+#include "graphics_pipeline.h"
+#include "memory_allocator.h"
+#include "pipeline_cache.h"
+#include "thread_pool.h"
+#include "upload_manager.h"
+
 struct VulkanBase
 {
   struct VulkanWindow
   {
+    // Instance extensions the window system needs to create its surface.
+    virtual std::vector<const char*> GetInstanceExtensions() = 0;
     virtual VkSurfaceKHR CreateSurface(VkInstance instance) = 0;
     virtual VkExtent2D GetExtent() = 0;
   };
 
+  struct Settings
+  {
+    uint32_t framesInFlight = 2;
+    // Run uploads on a transfer-only queue family if the device has one.
+    bool dedicatedTransferQueue = true;
+    // Enables the validation layer if it is installed.
+    bool validation = true;
+    // GPU timestamps and pipeline statistics, see gpuProfiler.
+    bool gpuProfiling = true;
+    // Used without a window, frames then go to offscreen images that can be
+    // read back instead of being presented.
+    VkExtent2D headlessExtent = { 1280, 720 };
+    uint32_t headlessImageCount = 3;
+    // Threads recording draws into secondary command buffers, see recorder.
+    // They come from threadPool plus the main thread. Zero uses all of them,
+    // one records draws inline into the frame's primary command buffer.
+    uint32_t recordThreads = 0;
+    // Copies of the scene the renderer draws, one draw call each unless
+    // instancing is set, which draws all of them at once.
+    uint32_t objectCount = 1;
+    bool instancing = false;
+    // Reads the draws from a GPU buffer of indirect commands, batched by
+    // pipeline and mesh. Combined with instancing one command draws all
+    // objects.
+    bool indirectDraws = false;
+    // Culls objects against the view frustum in a compute pass and draws
+    // the visible ones with a single indirect instanced draw. Overrides
+    // instancing and indirectDraws.
+    bool gpuCulling = false;
+    // Culls objects against the view frustum on the CPU every frame and
+    // draws only the visible ones. Ignored with gpuCulling and
+    // indirectDraws, their draws are kept on the GPU.
+    bool cpuCulling = false;
+    // Runs compute passes on a queue of their own, from a compute-only
+    // family if the device has one or else a second queue of the graphics
+    // family. A frame's compute work then overlaps the previous frame's
+    // graphics work. Falls back to the graphics queue if neither exists.
+    bool asyncCompute = false;
+    // Draws the scene from PackedVertex instead of Vertex.
+    bool packedVertices = false;
+    // Keeps the renderer's command buffer of every frame slot and swapchain
+    // image and submits it again until something it recorded changes, see
+    // Renderer::MarkDirty. Such command buffers record their draws inline.
+    bool reuseCommandBuffers = false;
+    // Frame slots allocate their command buffers from a transient pool that
+    // BeginFrame resets as a whole. Otherwise the pool allows resetting
+    // single buffers and each one is reset before it is recorded.
+    bool resetCommandPools = true;
+  };
+
   VulkanWindow* window = nullptr;
+  Settings settings;
 
   VkInstance instance = VK_NULL_HANDLE;
   std::vector<const char*> instanceLayers;
@@ -39,6 +100,11 @@ struct VulkanBase
 
     uint32_t GetGrahicsQueueFamiliyIdx();
     uint32_t GetPresentQueueFamiliyIdx();
+    // Family with transfer but neither graphics nor compute support, these
+    // map to the DMA engines. Returns -1 if there is none.
+    uint32_t GetTransferQueueFamiliyIdx();
+    // Family with compute but without graphics support.
+    uint32_t GetComputeQueueFamiliyIdx();
 
     // Surface capabilities are not static, e.g. currentExtent might change.
     VkSurfaceCapabilitiesKHR GetSurfaceCapabilities();
@@ -50,12 +116,31 @@ struct VulkanBase
   std::vector<const char*> deviceExtensions;
   VkDevice device;
   PhysicalDeviceProps physicalDeviceProps;
+  // Subset of physicalDeviceProps.features the device was created with.
+  VkPhysicalDeviceFeatures enabledFeatures = {};
   VkQueue queue;
+  uint32_t queueFamiliyIdx = (uint32_t)-1;
+  // Same as queue unless a dedicated transfer family is in use.
+  VkQueue transferQueue = VK_NULL_HANDLE;
+  uint32_t transferQueueFamiliyIdx = (uint32_t)-1;
+  // Same as queue unless Settings::asyncCompute found another queue.
+  VkQueue computeQueue = VK_NULL_HANDLE;
+  uint32_t computeQueueFamiliyIdx = (uint32_t)-1;
   VkCommandPool cmdPool;
+  MemoryAllocator* allocator = nullptr;
+  UploadManager* uploader = nullptr;
+  PipelineCache* pipelineCache = nullptr;
+  PipelineObjectCache* pipelineObjectCache = nullptr;
+  ThreadPool* threadPool = nullptr;
+  // Never null, does nothing if profiling is off or unsupported.
+  GpuProfiler* gpuProfiler = nullptr;
+  // Per frame slot secondary command pools, reset by BeginFrame.
+  CommandRecorder* recorder = nullptr;
 
   struct Swapchain
   {
     VkDevice device = VK_NULL_HANDLE;
+    // VK_NULL_HANDLE for offscreen images, see the headless constructor.
     VkSwapchainKHR handle = VK_NULL_HANDLE;
     VkSurfaceFormatKHR surfaceFormat = {};
     VkPresentModeKHR presentMode = {};
@@ -63,10 +148,18 @@ struct VulkanBase
     uint32_t imageCount = {};
     std::vector<VkImage> images = {};
     std::vector<VkImageView> imageViews = {};
+    MemoryAllocator* allocator = nullptr;
+    std::vector<MemoryAllocator::Allocation> imageAllocations = {};
 
     Swapchain(VkDevice device,
               PhysicalDeviceProps physicalDeviceProps,
               VkSurfaceKHR surface);
+    // Offscreen images with the same format a window would get. They end up
+    // in TRANSFER_SRC_OPTIMAL after each frame and can be copied out.
+    Swapchain(VkDevice device,
+              MemoryAllocator* allocator,
+              VkExtent2D extent,
+              uint32_t imageCount);
 
     Swapchain() = delete;
     Swapchain(const Swapchain&) = delete;
@@ -79,30 +172,87 @@ struct VulkanBase
 
   VkImage depthImage = VK_NULL_HANDLE;
   VkImageView depthImageView = VK_NULL_HANDLE;
-  VkDeviceMemory depthImageMemory = {};
-
-  VkSemaphore imageAvailableSemaphore = VK_NULL_HANDLE;
-  VkSemaphore renderFinishedSemaphore = VK_NULL_HANDLE;
+  MemoryAllocator::Allocation depthImageAllocation = {};
 
   VkRenderPass renderPass = VK_NULL_HANDLE;
   std::vector<VkFramebuffer> framebuffers = {};
 
-  std::vector<VkCommandBuffer> commandBuffers = {};
-  std::vector<VkFence> fences = {};
+  // A frame slot owns everything the CPU touches while recording a frame. A
+  // slot is reused only after its fence signalled, so recording frame N+1
+  // overlaps the GPU executing frame N.
+  struct Frame
+  {
+    // Owns the slot's command buffers, see Settings::resetCommandPools.
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkSemaphore imageAvailableSemaphore = VK_NULL_HANDLE;
+    VkSemaphore renderFinishedSemaphore = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    // Small command buffer submitted ahead of the frame's other work, e.g.
+    // to reset its queries before the upload batch.
+    VkCommandBuffer prologueCommandBuffer = VK_NULL_HANDLE;
+    // Async compute only. The frame's compute work signals the semaphore,
+    // its graphics work waits on it. The frame's fence covers both, the
+    // graphics submission cannot finish before the compute one.
+    VkCommandPool computeCommandPool = VK_NULL_HANDLE;
+    VkCommandBuffer computeCommandBuffer = VK_NULL_HANDLE;
+    VkSemaphore computeFinishedSemaphore = VK_NULL_HANDLE;
+  };
+
+  uint32_t framesInFlight = 2;
+  uint32_t frameIdx = 0;
+  std::vector<Frame> frames = {};
+
+  // Fence of the frame slot that last rendered into each swapchain image. The
+  // image count and the frame count are independent, so an acquired image
+  // might still be in use by another slot.
+  std::vector<VkFence> imageFences = {};
+  // Image handed to the last Present call, -1 before the first frame.
+  uint32_t presentedImageIdx = (uint32_t)-1;
 
   // --------------------------------------------------------------------------
   // --------------------------------------------------------------------------
 
-  VulkanBase(VulkanWindow* window);
+  VulkanBase(VulkanWindow* window, Settings settings);
   ~VulkanBase();
   void Update();
   virtual void OnSwapchainReinitialized() = 0;
 
+  bool IsHeadless() const { return window == nullptr; }
+  bool HasAsyncCompute() const { return computeQueue != queue; }
+
+  // Waits until the current frame slot is free again and returns it. Resets
+  // the slot's secondary command buffers.
+  Frame& BeginFrame();
+  // Remembers which slot renders into imageIdx and waits for the previous user
+  // of that image. Call after vkAcquireNextImageKHR.
+  void WaitForImage(uint32_t imageIdx);
+  void EndFrame();
+  // Readies a command buffer of the current slot for recording. Does nothing
+  // if BeginFrame reset the slot's pool.
+  void ResetFrameCommandBuffer(VkCommandBuffer cmd);
+
+  // Returns the next image to render into. Windowed, the submission must wait
+  // on frame.imageAvailableSemaphore and signal frame.renderFinishedSemaphore;
+  // headless, both semaphores stay unused.
+  uint32_t AcquireNextImage(const Frame& frame);
+  void Present(const Frame& frame, uint32_t imageIdx);
+
+  // Copies a rendered image to host memory, tightly packed rows in
+  // swapchain->surfaceFormat. Blocks until the last frame rendering into the
+  // image finished. Headless only, swapchain images cannot be copied from.
+  std::vector<uint8_t> ReadbackImage(uint32_t imageIdx);
+
 private:
+  uint32_t headlessImageIdx = 0;
+
   void ReinitSwapchain();
+  Swapchain* CreateSwapchain();
 
   void CreateSwapchainIndependentResources();
   void DestroySwapchainIndependentResources();
+  void CreateFrames();
+  void DestroyFrames();
   void CreateSwapchainDependentResources();
   void DestroySwapchainDependentResources();
 };
@@ -1,7 +1,7 @@
 #ifndef VK_INIT_H_
 #define VK_INIT_H_
 
-#include <vulkan\vulkan_core.h>
+#include <vulkan/vulkan_core.h>
 
 inline VkApplicationInfo
 vkiApplicationInfo(const char* pApplicationName,
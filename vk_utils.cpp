@@ -1,4 +1,5 @@
 #include "vk_utils.h"
+#include <cstdio>
 #include <string>
 
 std::string
@@ -6,8 +7,7 @@ loadFile(const char* filename)
 {
   std::string buffer;
 
-  FILE* file = 0;
-  fopen_s(&file, filename, "rb");
+  FILE* file = fopen(filename, "rb");
 
   if (file) {
     fseek(file, 0, SEEK_END);
@@ -26,7 +26,7 @@ loadFile(const char* filename)
 }
 
 VkShaderModule
-vkuLoadShaderModule(VkDevice device, char* filename)
+vkuLoadShaderModule(VkDevice device, const char* filename)
 {
   std::string buffer = loadFile(filename);
 
@@ -1,9 +1,10 @@
 #ifndef VK_UTILS_H_
 #define VK_UTILS_H_
 
+#include <cstring>
 #include <initializer_list>
-#include <memory> // memcpy
-#include <vulkan\vulkan.h>
+#include <vector>
+#include <vulkan/vulkan.h>
 
 #include "vk_init.h"
 
@@ -27,7 +28,7 @@
 inline VkPipeline
 vkuCreateGraphicsPipeline(
   VkDevice device,
-  std::initializer_list<VkPipelineShaderStageCreateInfo> stages,
+  const std::vector<VkPipelineShaderStageCreateInfo>& stages,
   VkPipelineVertexInputStateCreateInfo vertexInputState,
   VkPipelineInputAssemblyStateCreateInfo inputAssemblyState,
   VkPipelineTessellationStateCreateInfo tessellationState,
@@ -41,11 +42,12 @@ vkuCreateGraphicsPipeline(
   VkRenderPass renderPass,
   uint32_t subpass,
   VkPipeline basePipelineHandle,
-  int32_t basePipelineIndex)
+  int32_t basePipelineIndex,
+  VkPipelineCache pipelineCache = VK_NULL_HANDLE)
 {
   auto graphicsPipelineCreateInfo =
     vkiGraphicsPipelineCreateInfo(static_cast<uint32_t>(stages.size()),
-                                  stages.begin(),
+                                  stages.data(),
                                   &vertexInputState,
                                   &inputAssemblyState,
                                   &tessellationState,
@@ -63,7 +65,26 @@ vkuCreateGraphicsPipeline(
 
   VkPipeline pipeline = VK_NULL_HANDLE;
   VkResult result = vkCreateGraphicsPipelines(
-    device, VK_NULL_HANDLE, 1, &graphicsPipelineCreateInfo, nullptr, &pipeline);
+    device, pipelineCache, 1, &graphicsPipelineCreateInfo, nullptr, &pipeline);
+  return pipeline;
+}
+
+inline VkPipeline
+vkuCreateComputePipeline(VkDevice device,
+                         VkShaderModule module,
+                         VkPipelineLayout layout,
+                         VkPipelineCache pipelineCache = VK_NULL_HANDLE,
+                         const char* entryPoint = "main",
+                         const VkSpecializationInfo* specialization = nullptr)
+{
+  auto stage = vkiPipelineShaderStageCreateInfo(
+    VK_SHADER_STAGE_COMPUTE_BIT, module, entryPoint, specialization);
+  auto computePipelineCreateInfo =
+    vkiComputePipelineCreateInfo(stage, layout, VK_NULL_HANDLE, -1);
+
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  vkCreateComputePipelines(
+    device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &pipeline);
   return pipeline;
 }
 
@@ -79,12 +100,16 @@ vkuCreateShaderModule(VkDevice device,
   return handle;
 }
 
+// Reads a SPIR-V file, returns VK_NULL_HANDLE if it cannot be loaded.
+VkShaderModule
+vkuLoadShaderModule(VkDevice device, const char* filename);
+
 inline VkBuffer
 vkuCreateBuffer(VkDevice device,
                 VkDeviceSize size,
                 VkBufferUsageFlags usage,
                 VkSharingMode sharingMode,
-                std::initializer_list<uint32_t> queueFamilyIndices,
+                const std::vector<uint32_t>& queueFamilyIndices,
                 const VkAllocationCallbacks* pAllocator = nullptr)
 {
   auto info =
@@ -92,7 +117,7 @@ vkuCreateBuffer(VkDevice device,
                         usage,
                         sharingMode,
                         static_cast<uint32_t>(queueFamilyIndices.size()),
-                        queueFamilyIndices.begin());
+                        queueFamilyIndices.data());
   VkBuffer handle = VK_NULL_HANDLE;
   vkCreateBuffer(device, &info, pAllocator, &handle);
   return handle;
@@ -148,6 +173,29 @@ vkuTransitionLayout(VkCommandBuffer commandBuffer,
                        &imageMemoryBarrier);
 }
 
+// Makes writes of the source stages visible to the destination stages.
+inline void
+vkuCmdMemoryBarrier(VkCommandBuffer commandBuffer,
+                    VkPipelineStageFlags srcStageFlags,
+                    VkAccessFlags srcAccessFlags,
+                    VkPipelineStageFlags dstStageFlags,
+                    VkAccessFlags dstAccessFlags)
+{
+  VkMemoryBarrier memoryBarrier =
+    vkiMemoryBarrier(srcAccessFlags, dstAccessFlags);
+
+  vkCmdPipelineBarrier(commandBuffer,
+                       srcStageFlags,
+                       dstStageFlags,
+                       0,
+                       1,
+                       &memoryBarrier,
+                       0,
+                       nullptr,
+                       0,
+                       nullptr);
+}
+
 inline VkAccessFlags
 vkuGetImageAccessFlags(VkImageLayout imageLayout)
 {
@@ -331,7 +379,7 @@ vkuTransferData(VkDevice device,
                 void* data)
 {
   void* mappedMemory;
-  vkMapMemory(device, memory, 0, size, 0, &mappedMemory);
+  vkMapMemory(device, memory, offset, size, 0, &mappedMemory);
   memcpy(mappedMemory, data, size);
   auto memoryRange = vkiMappedMemoryRange(memory, offset, VK_WHOLE_SIZE);
   vkFlushMappedMemoryRanges(device, 1, &memoryRange);
@@ -358,6 +406,8 @@ vkuBeginCmdBuffer(VkCommandBuffer commandBuffer,
   vkBeginCommandBuffer(commandBuffer, &info);
 }
 
+// Blocking one-off uploads that create and destroy their own staging buffer.
+// Use UploadManager to batch uploads without stalling.
 inline void
 vkuTransferImageData(VkDevice device,
                      VkPhysicalDeviceMemoryProperties memProps,
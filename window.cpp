@@ -58,7 +58,7 @@ onWindowSize(GLFWwindow* glfwWindow, int width, int height)
   }
 }
 
-Window::Window(int width, int height, char* title)
+Window::Window(int width, int height, const char* title)
 {
   glfwInit();
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -101,6 +101,14 @@ Window::GetExtent()
            static_cast<uint32_t>(windowSize.height) };
 }
 
+std::vector<const char*>
+Window::GetInstanceExtensions()
+{
+  uint32_t count = 0;
+  const char** extensions = glfwGetRequiredInstanceExtensions(&count);
+  return std::vector<const char*>(extensions, extensions + count);
+}
+
 VkSurfaceKHR
 Window::CreateSurface(VkInstance instance)
 {
@@ -1,8 +1,8 @@
 #pragma once
 
 // clang-format off
-#include <vulkan\vulkan_core.h>
-#include <GLFW\glfw3.h>
+#include <vulkan/vulkan_core.h>
+#include <GLFW/glfw3.h>
 // clang-format on
 
 #include "vk_base.h"
@@ -11,10 +11,11 @@ struct Window : VulkanBase::VulkanWindow
 {
   GLFWwindow* glfwWindow;
 
-  Window(int width, int height, char* title);
+  Window(int width, int height, const char* title);
   void Update();
 
   VkExtent2D GetExtent();
+  std::vector<const char*> GetInstanceExtensions();
   VkSurfaceKHR CreateSurface(VkInstance instance);
 
   struct KeyInput